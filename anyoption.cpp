@@ -61,6 +61,112 @@
 
 #include "anyoption.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <map>
+#include <new>
+#include <cstdint>
+#include <cstdio>
+#include <sys/stat.h>
+
+#if !defined(_WIN32)
+#define ANYOPTION_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+#include <io.h>
+#define environ _environ
+#else
+extern char **environ;
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define ANYOPTION_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(ANYOPTION_SSE2) && defined(__GNUC__) /* cpu checked at runtime */
+#define ANYOPTION_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__linux__)
+#define ANYOPTION_INOTIFY
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+static void *defaultAllocate(size_t size, void *) { return malloc(size); }
+
+static void defaultDeallocate(void *block, size_t, void *) { free(block); }
+
+static const unsigned int STORAGE_BLOCKS = 12; /* see AnyOption::storage() */
+
+static const AnyOptionAllocator default_allocator = {defaultAllocate,
+                                                     defaultDeallocate, nullptr};
+
+/*
+ * calls into other allocators are serialized, file and
+ * layer threads share them and they need not be thread safe
+ */
+static mutex allocator_mutex;
+
+static void *allocateFrom(const AnyOptionAllocator &allocator, size_t size) {
+  if (allocator.allocate == defaultAllocate)
+    return malloc(size);
+  lock_guard<mutex> lock(allocator_mutex);
+  return allocator.allocate(size, allocator.data);
+}
+
+static void deallocateTo(const AnyOptionAllocator &allocator, void *block,
+                         size_t size) {
+  if (allocator.deallocate == defaultDeallocate) {
+    free(block);
+    return;
+  }
+  lock_guard<mutex> lock(allocator_mutex);
+  allocator.deallocate(block, size, allocator.data);
+}
+
+static string canonicalPath(const char *path) {
+#if defined(_WIN32)
+  char full[_MAX_PATH];
+  if (_fullpath(full, path, _MAX_PATH) != nullptr)
+    return full;
+#else
+  char *full = realpath(path, nullptr);
+  if (full != nullptr) {
+    string canonical(full);
+    free(full);
+    return canonical;
+  }
+#endif
+  return path;
+}
+
+/*
+ * an option file being parsed, include lines take their
+ * directory from it and are stopped when they cycle back
+ */
+struct AnyOptionIncludeFrame {
+  string path; /* canonical */
+  const AnyOptionIncludeFrame *parent;
+
+  AnyOptionIncludeFrame(const string &_path, const AnyOptionIncludeFrame *_parent)
+      : path(_path), parent(_parent) {}
+};
+
 AnyOption::AnyOption() { init(); }
 
 AnyOption::AnyOption(unsigned int maxopt) { init(maxopt, maxopt); }
@@ -87,14 +193,36 @@ void AnyOption::init(unsigned int maxopt, unsigned int maxcharopt) {
   filename = nullptr;
   appname = nullptr;
   option_counter = 0;
+  optionhash = nullptr;
+  optionhash_size = 0;
   optchar_counter = 0;
-  new_argv = nullptr;
-  new_argc = 0;
+  for (unsigned int i = 0; i < OPTION_CHAR_SLOTS; i++)
+    optcharmap[i] = -1;
+  envnames = nullptr;
+  envname_size = 0;
+  envname_count = 0;
+  envname_bound = 0;
+  env_prefix = nullptr;
+  trie = nullptr;
+  trie_size = 0;
+  trie_count = 0;
   max_legal_args = 0;
   command_set = false;
   file_set = false;
-  values = nullptr;
   g_value_counter = 0;
+  map_file = false;
+  file_threads = 1;
+  file_cache = false;
+  file_includes = false;
+  instrument = false;
+  stats_callback = nullptr;
+  stats_data = nullptr;
+  memset(&registration, 0, sizeof(registration));
+  allocator = default_allocator;
+  borrow_argv = false;
+  response_files = false;
+  abbreviate = false;
+  completion_option = nullptr;
   mem_allocated = false;
   opt_prefix_char = '-';
   file_delimiter_char = ':';
@@ -106,7 +234,6 @@ void AnyOption::init(unsigned int maxopt, unsigned int maxcharopt) {
   whitespace = ' ';
   nullterminate = '\0';
   set = false;
-  once = true;
   hasoptions = false;
   autousage = false;
   print_usage = false;
@@ -129,37 +256,57 @@ bool AnyOption::alloc() {
   if (mem_allocated)
     return true;
 
+  options = nullptr; /* for freeStorage() on failure */
+  optiontype = nullptr;
+  optionindex = nullptr;
+  optionnext = nullptr;
+  optionchars = nullptr;
+  optchartype = nullptr;
+  optcharindex = nullptr;
+  optcharnext = nullptr;
+  usage = nullptr;
   size = (max_options + 1) * sizeof(const char *);
-  options = (const char **)malloc(size);
-  optiontype = (OptionType *)malloc((max_options + 1) * sizeof(OptionType));
-  optionindex = (int *)malloc((max_options + 1) * sizeof(int));
-  if (options == nullptr || optiontype == nullptr || optionindex == nullptr)
+  options = (const char **)allocBlock(size);
+  optiontype = (OptionType *)allocBlock((max_options + 1) * sizeof(OptionType));
+  optionindex = (int *)allocBlock((max_options + 1) * sizeof(int));
+  optionnext = (int *)allocBlock((max_options + 1) * sizeof(int));
+  if (options == nullptr || optiontype == nullptr || optionindex == nullptr ||
+      optionnext == nullptr) {
+    freeStorage();
     return false;
-  else
-    mem_allocated = true;
+  }
+  mem_allocated = true;
   for (i = 0; i < max_options; i++) {
     options[i] = nullptr;
     optiontype[i] = INVALID_OPT;
     optionindex[i] = -1;
+    optionnext[i] = -1;
+  }
+  if (!buildOptHash()) {
+    freeStorage();
+    return false;
   }
-  optionchars = (char *)malloc((max_char_options + 1) * sizeof(char));
-  optchartype = (OptionType *)malloc((max_char_options + 1) * sizeof(OptionType));
-  optcharindex = (int *)malloc((max_char_options + 1) * sizeof(int));
-  if (optionchars == nullptr || optchartype == nullptr || optcharindex == nullptr) {
-    mem_allocated = false;
+  optionchars = (char *)allocBlock((max_char_options + 1) * sizeof(char));
+  optchartype = (OptionType *)allocBlock((max_char_options + 1) * sizeof(OptionType));
+  optcharindex = (int *)allocBlock((max_char_options + 1) * sizeof(int));
+  optcharnext = (int *)allocBlock((max_char_options + 1) * sizeof(int));
+  if (optionchars == nullptr || optchartype == nullptr || optcharindex == nullptr ||
+      optcharnext == nullptr) {
+    freeStorage();
     return false;
   }
   for (i = 0; i < max_char_options; i++) {
     optionchars[i] = '0';
     optchartype[i] = INVALID_OPT;
     optcharindex[i] = -1;
+    optcharnext[i] = -1;
   }
 
   size = (max_usage_lines + 1) * sizeof(const char *);
-  usage = (const char **)malloc(size);
+  usage = (const char **)allocBlock(size);
 
   if (usage == nullptr) {
-    mem_allocated = false;
+    freeStorage();
     return false;
   }
   for (i = 0; i < max_usage_lines; i++)
@@ -168,87 +315,327 @@ bool AnyOption::alloc() {
   return true;
 }
 
-void AnyOption::allocValues(int index, size_t length) {
-  if (values[index] == nullptr) {
-    values[index] = new char [length];
-  } else {
-    delete[] values[index];
-    values[index] = new char [length];
-  }
-}
-
 bool AnyOption::doubleOptStorage() {
-  const char **options_saved = options;
-  options = (const char **)realloc(options, ((2 * max_options) + 1) *
-                                                sizeof(const char *));
-  if (options == nullptr) {
-    free(options_saved);
-    return false;
-  }
-  OptionType *optiontype_saved = optiontype;
-  optiontype =
-      (OptionType *)realloc(optiontype, ((2 * max_options) + 1) * sizeof(OptionType));
-  if (optiontype == nullptr) {
-    free(optiontype_saved);
-    return false;
-  }
-  int *optionindex_saved = optionindex;
-  optionindex =
-      (int *)realloc(optionindex, ((2 * max_options) + 1) * sizeof(int));
-  if (optionindex == nullptr) {
-    free(optionindex_saved);
+  const size_t count = max_options + 1;
+  const size_t grown = (2 * max_options) + 1;
+  const char **options_grown =
+      (const char **)allocBlock(grown * sizeof(const char *));
+  OptionType *optiontype_grown = (OptionType *)allocBlock(grown * sizeof(OptionType));
+  int *optionindex_grown = (int *)allocBlock(grown * sizeof(int));
+  int *optionnext_grown = (int *)allocBlock(grown * sizeof(int));
+  if (options_grown == nullptr || optiontype_grown == nullptr ||
+      optionindex_grown == nullptr || optionnext_grown == nullptr) {
+    freeBlock(options_grown, grown * sizeof(const char *));
+    freeBlock(optiontype_grown, grown * sizeof(OptionType));
+    freeBlock(optionindex_grown, grown * sizeof(int));
+    freeBlock(optionnext_grown, grown * sizeof(int));
     return false;
   }
+  memcpy(options_grown, options, count * sizeof(const char *));
+  memcpy(optiontype_grown, optiontype, count * sizeof(OptionType));
+  memcpy(optionindex_grown, optionindex, count * sizeof(int));
+  memcpy(optionnext_grown, optionnext, count * sizeof(int));
+  freeBlock(options, count * sizeof(const char *));
+  freeBlock(optiontype, count * sizeof(OptionType));
+  freeBlock(optionindex, count * sizeof(int));
+  freeBlock(optionnext, count * sizeof(int));
+  options = options_grown;
+  optiontype = optiontype_grown;
+  optionindex = optionindex_grown;
+  optionnext = optionnext_grown;
   /* init new storage */
   for (unsigned int i = max_options; i < 2 * max_options; i++) {
     options[i] = nullptr;
     optiontype[i] = INVALID_OPT;
     optionindex[i] = -1;
+    optionnext[i] = -1;
   }
   max_options = 2 * max_options;
-  return true;
+  registration.allocations += 4;
+  registration.allocated_bytes +=
+      (max_options + 1) * (sizeof(const char *) + sizeof(OptionType) + 2 * sizeof(int));
+  return buildOptHash();
 }
 
 bool AnyOption::doubleCharStorage() {
-  char *optionchars_saved = optionchars;
-  optionchars =
-      (char *)realloc(optionchars, ((2 * max_char_options) + 1) * sizeof(char));
-  if (optionchars == nullptr) {
-    free(optionchars_saved);
-    return false;
-  }
-  OptionType *optchartype_saved = optchartype;
-  optchartype =
-      (OptionType *)realloc(optchartype, ((2 * max_char_options) + 1) * sizeof(OptionType));
-  if (optchartype == nullptr) {
-    free(optchartype_saved);
-    return false;
-  }
-  int *optcharindex_saved = optcharindex;
-  optcharindex =
-      (int *)realloc(optcharindex, ((2 * max_char_options) + 1) * sizeof(int));
-  if (optcharindex == nullptr) {
-    free(optcharindex_saved);
+  const size_t count = max_char_options + 1;
+  const size_t grown = (2 * max_char_options) + 1;
+  char *optionchars_grown = (char *)allocBlock(grown * sizeof(char));
+  OptionType *optchartype_grown = (OptionType *)allocBlock(grown * sizeof(OptionType));
+  int *optcharindex_grown = (int *)allocBlock(grown * sizeof(int));
+  int *optcharnext_grown = (int *)allocBlock(grown * sizeof(int));
+  if (optionchars_grown == nullptr || optchartype_grown == nullptr ||
+      optcharindex_grown == nullptr || optcharnext_grown == nullptr) {
+    freeBlock(optionchars_grown, grown * sizeof(char));
+    freeBlock(optchartype_grown, grown * sizeof(OptionType));
+    freeBlock(optcharindex_grown, grown * sizeof(int));
+    freeBlock(optcharnext_grown, grown * sizeof(int));
     return false;
   }
+  memcpy(optionchars_grown, optionchars, count * sizeof(char));
+  memcpy(optchartype_grown, optchartype, count * sizeof(OptionType));
+  memcpy(optcharindex_grown, optcharindex, count * sizeof(int));
+  memcpy(optcharnext_grown, optcharnext, count * sizeof(int));
+  freeBlock(optionchars, count * sizeof(char));
+  freeBlock(optchartype, count * sizeof(OptionType));
+  freeBlock(optcharindex, count * sizeof(int));
+  freeBlock(optcharnext, count * sizeof(int));
+  optionchars = optionchars_grown;
+  optchartype = optchartype_grown;
+  optcharindex = optcharindex_grown;
+  optcharnext = optcharnext_grown;
   /* init new storage */
   for (unsigned int i = max_char_options; i < 2 * max_char_options; i++) {
     optionchars[i] = '0';
     optchartype[i] = INVALID_OPT;
     optcharindex[i] = -1;
+    optcharnext[i] = -1;
   }
   max_char_options = 2 * max_char_options;
+  registration.allocations += 4;
+  registration.allocated_bytes +=
+      (max_char_options + 1) * (sizeof(char) + sizeof(OptionType) + 2 * sizeof(int));
   return true;
 }
 
-bool AnyOption::doubleUsageStorage() {
-  const char **usage_saved = usage;
-  usage = (const char **)realloc(usage, ((2 * max_usage_lines) + 1) *
-                                            sizeof(const char *));
-  if (usage == nullptr) {
-    free(usage_saved);
+/*
+ * (re)builds the hash index over the option strings, sized to
+ * keep the load factor at or below one half of max_options
+ */
+bool AnyOption::buildOptHash() {
+  unsigned int size = 1;
+  while (size < 2 * max_options)
+    size <<= 1;
+  int *table = (int *)allocBlock(size * sizeof(int));
+  if (table == nullptr)
+    return false;
+  freeBlock(optionhash, optionhash_size * sizeof(int));
+  optionhash = table;
+  optionhash_size = size;
+  for (unsigned int i = 0; i < optionhash_size; i++)
+    optionhash[i] = -1;
+  for (unsigned int i = 0; i < option_counter; i++) {
+    optionnext[i] = -1;
+    hashOption(i);
+  }
+  return true;
+}
+
+/*
+ * adds options[index] to the hash index, options registered
+ * more than once under the same name are chained in order
+ */
+void AnyOption::hashOption(int index) {
+  const char *opt = options[index];
+  const unsigned int mask = optionhash_size - 1;
+  unsigned int h = hashString(opt, strlen(opt)) & mask;
+  while (optionhash[h] != -1) {
+    int i = optionhash[h];
+    if (strcmp(options[i], opt) == 0) { /* same name, chain it */
+      while (optionnext[i] != -1)
+        i = optionnext[i];
+      optionnext[i] = index;
+      return;
+    }
+    h = (h + 1) & mask;
+  }
+  optionhash[h] = index;
+}
+
+int AnyOption::findOption(const char *opt) const {
+  return findOption(opt, strlen(opt));
+}
+
+/*
+ * returns the index of the first option registered with the
+ * name opt[0..length), or -1, use optionnext[] for the rest
+ */
+int AnyOption::findOption(const char *opt, size_t length) const {
+  const unsigned int mask = optionhash_size - 1;
+  unsigned int h = hashString(opt, length) & mask;
+  while (optionhash[h] != -1) {
+    int i = optionhash[h];
+    if (strncmp(options[i], opt, length) == 0 && options[i][length] == nullterminate)
+      return i;
+    h = (h + 1) & mask;
+  }
+  return -1;
+}
+
+/*
+ * returns the index of the first option registered with the
+ * char optchar, or -1, use optcharnext[] for the rest
+ */
+int AnyOption::findChar(char optchar) const {
+  return optcharmap[(unsigned char)optchar];
+}
+
+/* FNV-1a */
+unsigned int AnyOption::hashString(const char *str, size_t length) {
+  unsigned int h = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    h ^= (unsigned char)str[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/*
+ * long option prefix trie
+ *
+ * one node per character of the command line option names,
+ * children in character order, each node counts the names
+ * below it so a prefix is unambiguous when it counts one
+ */
+
+static bool isCommand(OptionType type) {
+  return type == COMMON_OPT || type == COMMAND_OPT || type == COMMON_FLAG ||
+         type == COMMAND_FLAG;
+}
+
+bool AnyOption::trieWanted() const {
+  return abbreviate || completion_option != nullptr;
+}
+
+/*
+ * builds the trie over the options registered so far,
+ * addOption() keeps it up to date after that
+ */
+bool AnyOption::buildTrie() {
+  const unsigned int size = 64;
+  trie = (TrieNode *)allocBlock(size * sizeof(TrieNode));
+  if (trie == nullptr) {
+    addOptionError(long_opt_prefix);
     return false;
   }
+  trie_size = size;
+  trie_count = 1;
+  TrieNode root = {0, -1, -1, -1, -1, 0};
+  trie[0] = root;
+  registration.allocations++;
+  registration.allocated_bytes += size * sizeof(TrieNode);
+  for (unsigned int i = 0; i < option_counter; i++) {
+    if (isCommand(optiontype[i]) && !trieOption(i)) {
+      addOptionError(options[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * adds the name of options[index], a name registered
+ * again is left to the optionnext[] chain
+ */
+bool AnyOption::trieOption(int index) {
+  const char *name = options[index];
+  const size_t length = strlen(name);
+  for (int i = findOption(name, length); i >= 0 && i < index; i = optionnext[i]) {
+    if (isCommand(optiontype[i])) /* already in the trie */
+      return true;
+  }
+  if (trie_count + length > trie_size) { /* room for a node per char */
+    unsigned int grown = 2 * trie_size;
+    while (grown < trie_count + length)
+      grown *= 2;
+    TrieNode *larger = (TrieNode *)growBlock(trie, trie_size * sizeof(TrieNode),
+                                             grown * sizeof(TrieNode));
+    if (larger == nullptr)
+      return false;
+    trie = larger;
+    trie_size = grown;
+    registration.allocations++;
+    registration.allocated_bytes += grown * sizeof(TrieNode);
+  }
+  int node = 0;
+  for (size_t i = 0;; i++) {
+    trie[node].names++;
+    if (trie[node].below < 0)
+      trie[node].below = index;
+    if (i == length)
+      break;
+    const unsigned char ch = (unsigned char)name[i];
+    int *link = &trie[node].child; /* find the child, or where it goes */
+    while (*link >= 0 && (unsigned char)trie[*link].ch < ch)
+      link = &trie[*link].sibling;
+    if (*link < 0 || (unsigned char)trie[*link].ch != ch) {
+      TrieNode child = {name[i], -1, *link, -1, -1, 0};
+      trie[trie_count] = child;
+      *link = trie_count++;
+    }
+    node = *link;
+  }
+  trie[node].option = index;
+  return true;
+}
+
+int AnyOption::trieChild(int node, char ch) const {
+  for (int i = trie[node].child;
+       i >= 0 && (unsigned char)trie[i].ch <= (unsigned char)ch;
+       i = trie[i].sibling) {
+    if (trie[i].ch == ch)
+      return i;
+  }
+  return -1;
+}
+
+/*
+ * the node for prefix[0..length), or -1
+ */
+int AnyOption::trieNode(const char *prefix, size_t length) const {
+  if (trie == nullptr)
+    return -1;
+  int node = 0;
+  for (size_t i = 0; i < length && node >= 0; i++)
+    node = trieChild(node, prefix[i]);
+  return node;
+}
+
+/*
+ * index into options of the one name starting with
+ * opt[0..length), -1 if none, -2 if more than one
+ */
+int AnyOption::findAbbreviation(const char *opt, size_t length,
+                                AnyOptionResult &result) const {
+  result.stats.lookups++; /* the trie walk */
+  int node = trieNode(opt, length);
+  if (node < 0 || trie[node].names == 0)
+    return -1;
+  return trie[node].names == 1 ? trie[node].below : -2;
+}
+
+unsigned int AnyOption::complete(const char *prefix, ostream &out) const {
+  const size_t long_length = strlen(long_opt_prefix);
+  const size_t length = strlen(prefix);
+  if (strncmp(prefix, long_opt_prefix, length < long_length ? length : long_length) == 0)
+    prefix += length < long_length ? length : long_length; /* "--ver" or "-" */
+  unsigned int count = 0;
+  int node = trieNode(prefix, strlen(prefix));
+  if (node >= 0)
+    printCompletions(node, out, count);
+  return count;
+}
+
+/*
+ * the names at and below node, in order
+ */
+void AnyOption::printCompletions(int node, ostream &out,
+                                 unsigned int &count) const {
+  if (trie[node].option >= 0) {
+    out << long_opt_prefix << options[trie[node].option] << endofline;
+    count++;
+  }
+  for (int i = trie[node].child; i >= 0; i = trie[i].sibling)
+    printCompletions(i, out, count);
+}
+
+bool AnyOption::doubleUsageStorage() {
+  const char **usage_grown = (const char **)growBlock(
+      usage, (max_usage_lines + 1) * sizeof(const char *),
+      ((2 * max_usage_lines) + 1) * sizeof(const char *));
+  if (usage_grown == nullptr)
+    return false;
+  usage = usage_grown;
   for (unsigned int i = max_usage_lines; i < 2 * max_usage_lines; i++)
     usage[i] = nullptr;
   max_usage_lines = 2 * max_usage_lines;
@@ -256,25 +643,115 @@ bool AnyOption::doubleUsageStorage() {
 }
 
 void AnyOption::cleanup() {
-  free(options);
-  free(optiontype);
-  free(optionindex);
-  free(optionchars);
-  free(optchartype);
-  free(optcharindex);
-  free(usage);
-  if (values != nullptr) {
-    for (unsigned int i = 0; i < g_value_counter; i++) {
-      delete[] values[i];
-      values[i] = nullptr;
+  void *blocks[STORAGE_BLOCKS];
+  size_t sizes[STORAGE_BLOCKS];
+  for (unsigned int i = 0; i < storage(blocks, sizes); i++)
+    freeBlock(blocks[i], sizes[i]);
+}
+
+/*
+ * frees what alloc() got so far and leaves nothing allocated
+ */
+void AnyOption::freeStorage() {
+  cleanup();
+  options = nullptr;
+  optiontype = nullptr;
+  optionindex = nullptr;
+  optionnext = nullptr;
+  optionhash = nullptr;
+  optionhash_size = 0;
+  optionchars = nullptr;
+  optchartype = nullptr;
+  optcharindex = nullptr;
+  optcharnext = nullptr;
+  usage = nullptr;
+  mem_allocated = false;
+}
+
+/*
+ * the option and usage storage blocks and their sizes
+ */
+unsigned int AnyOption::storage(void *blocks[], size_t sizes[]) const {
+  const size_t opts = max_options + 1;
+  const size_t chars = max_char_options + 1;
+  void *const all[STORAGE_BLOCKS] = {options,      optiontype,  optionindex,
+                                     optionnext,   optionhash,  optionchars,
+                                     optchartype,  optcharindex, optcharnext,
+                                     usage,        envnames,    trie};
+  const size_t all_sizes[STORAGE_BLOCKS] = {
+      opts * sizeof(const char *), opts * sizeof(OptionType),
+      opts * sizeof(int),          opts * sizeof(int),
+      optionhash_size * sizeof(int), chars * sizeof(char),
+      chars * sizeof(OptionType),  chars * sizeof(int),
+      chars * sizeof(int),         (max_usage_lines + 1) * sizeof(const char *),
+      envname_size * sizeof(EnvName), trie_size * sizeof(TrieNode)};
+  for (unsigned int i = 0; i < STORAGE_BLOCKS; i++) {
+    blocks[i] = all[i];
+    sizes[i] = all_sizes[i];
+  }
+  return STORAGE_BLOCKS;
+}
+
+void *AnyOption::allocBlock(size_t size) const {
+  return allocateFrom(allocator, size);
+}
+
+void AnyOption::freeBlock(void *block, size_t size) const {
+  if (block != nullptr)
+    deallocateTo(allocator, block, size);
+}
+
+/*
+ * like realloc(), but block is kept when growing fails
+ */
+void *AnyOption::growBlock(void *block, size_t size, size_t grown) const {
+  void *larger = allocBlock(grown);
+  if (larger == nullptr)
+    return nullptr;
+  memcpy(larger, block, size);
+  freeBlock(block, size);
+  return larger;
+}
+
+bool AnyOption::setAllocator(const AnyOptionAllocator &_allocator) {
+  void *blocks[STORAGE_BLOCKS];
+  size_t sizes[STORAGE_BLOCKS];
+  void *moved[STORAGE_BLOCKS];
+  unsigned int count = mem_allocated ? storage(blocks, sizes) : 0;
+  for (unsigned int i = 0; i < count; i++) {
+    moved[i] = (blocks[i] != nullptr) ? allocateFrom(_allocator, sizes[i])
+                                      : nullptr;
+    if (blocks[i] != nullptr && moved[i] == nullptr) {
+      while (i-- > 0) { /* leave everything where it was */
+        if (moved[i] != nullptr)
+          deallocateTo(_allocator, moved[i], sizes[i]);
+      }
+      return false;
+    }
+  }
+  for (unsigned int i = 0; i < count; i++) {
+    if (blocks[i] != nullptr) {
+      memcpy(moved[i], blocks[i], sizes[i]);
+      freeBlock(blocks[i], sizes[i]);
     }
-    delete[] values;
-    values = nullptr;
   }
-  if (new_argv != nullptr){
-    delete[] new_argv;
-    new_argv = nullptr;
+  allocator = _allocator;
+  if (count > 0) {
+    options = (const char **)moved[0];
+    optiontype = (OptionType *)moved[1];
+    optionindex = (int *)moved[2];
+    optionnext = (int *)moved[3];
+    optionhash = (int *)moved[4];
+    optionchars = (char *)moved[5];
+    optchartype = (OptionType *)moved[6];
+    optcharindex = (int *)moved[7];
+    optcharnext = (int *)moved[8];
+    usage = (const char **)moved[9];
+    envnames = (EnvName *)moved[10];
+    trie = (TrieNode *)moved[11];
   }
+  parsed.rebase(allocator); /* the classic values */
+  return true;
 }
 
 void AnyOption::setCommandPrefixChar(char _prefix) {
@@ -298,6 +775,20 @@ void AnyOption::setFileDelimiterChar(char _delimiter) {
   file_comment_char = _delimiter;
 }
 
+void AnyOption::setEnvironmentPrefix(const char *_prefix) {
+  const char *previous = env_prefix;
+  env_prefix = _prefix;
+  unsigned int count = envname_bound;
+  for (unsigned int i = 0; i < option_counter; i++) {
+    if (envNamed(optiontype[i]))
+      count++;
+  }
+  if (!buildEnvHash(count)) { /* keep the names there were */
+    env_prefix = previous;
+    addOptionError(_prefix);
+  }
+}
+
 bool AnyOption::CommandSet() const { return (command_set); }
 
 bool AnyOption::FileSet() const { return (file_set); }
@@ -308,6 +799,149 @@ bool AnyOption::POSIX() const { return posix_style; }
 
 void AnyOption::setVerbose() { verbose = true; }
 
+void AnyOption::setFileMapping(bool _mapfile) { map_file = _mapfile; }
+
+void AnyOption::setArgvBorrowing(bool _borrow) { borrow_argv = _borrow; }
+
+void AnyOption::setResponseFiles(bool _response) { response_files = _response; }
+
+void AnyOption::setAbbreviations(bool _abbreviate) {
+  abbreviate = _abbreviate;
+  if (trieWanted() && trie == nullptr)
+    buildTrie();
+}
+
+void AnyOption::setCompletionOption(const char *_option) {
+  completion_option = _option;
+  if (trieWanted() && trie == nullptr)
+    buildTrie();
+}
+
+void AnyOption::setFileThreads(unsigned int _threads) {
+  file_threads = _threads;
+}
+
+void AnyOption::setFileCache(bool _cache) { file_cache = _cache; }
+
+void AnyOption::setFileIncludes(bool _includes) { file_includes = _includes; }
+
+void AnyOption::setInstrumentation(bool _instrument) {
+  instrument = _instrument;
+}
+
+void AnyOption::setStatsCallback(StatsCallback callback, void *data) {
+  stats_callback = callback;
+  stats_data = data;
+  if (callback != nullptr)
+    instrument = true;
+}
+
+static void addStats(AnyOptionStats &to, const AnyOptionStats &from) {
+  to.allocations += from.allocations;
+  to.allocated_bytes += from.allocated_bytes;
+  to.file_bytes += from.file_bytes;
+  to.lines += from.lines;
+  to.lookups += from.lookups;
+  to.register_ns += from.register_ns;
+  to.command_ns += from.command_ns;
+  to.file_ns += from.file_ns;
+  to.environment_ns += from.environment_ns;
+}
+
+AnyOptionStats AnyOption::getStats() const {
+  AnyOptionStats stats = registration;
+  addStats(stats, parsed.stats);
+  return stats;
+}
+
+static unsigned long long nowNs() {
+  return (unsigned long long)chrono::duration_cast<chrono::nanoseconds>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/*
+ * the start of a timed parse, 0 when not instrumented
+ */
+unsigned long long AnyOption::startPhase() const {
+  return instrument ? nowNs() : 0;
+}
+
+void AnyOption::finishPhase(ParsePhase phase, unsigned long long start,
+                            AnyOptionResult &result) const {
+  if (!instrument)
+    return;
+  unsigned long long elapsed = nowNs() - start;
+  if (phase == PARSE_COMMAND)
+    result.stats.command_ns += elapsed;
+  else if (phase == PARSE_ENVIRONMENT)
+    result.stats.environment_ns += elapsed;
+  else
+    result.stats.file_ns += elapsed;
+  if (stats_callback != nullptr)
+    stats_callback(phase, result.stats, stats_data);
+}
+
+enum { SCAN_SCALAR = 0, SCAN_SSE2 = 1, SCAN_AVX2 = 2 };
+
+static const char *const file_scanners[] = {"scalar", "sse2", "avx2"};
+static atomic<int> file_scanner(-1); /* picked on first use */
+
+static bool fileScannerSupported(int scanner) {
+  switch (scanner) {
+  case SCAN_SCALAR:
+    return true;
+#if defined(ANYOPTION_SSE2)
+  case SCAN_SSE2:
+    return true;
+#endif
+#if defined(ANYOPTION_AVX2)
+  case SCAN_AVX2:
+    return __builtin_cpu_supports("avx2");
+#endif
+  }
+  return false;
+}
+
+static int fileScannerIndex() {
+  int scanner = file_scanner.load(memory_order_relaxed);
+  if (scanner < 0) {
+    scanner = SCAN_AVX2;
+    while (!fileScannerSupported(scanner))
+      scanner--;
+    file_scanner.store(scanner, memory_order_relaxed);
+  }
+  return scanner;
+}
+
+const char *AnyOption::getFileScanner() {
+  return file_scanners[fileScannerIndex()];
+}
+
+bool AnyOption::setFileScanner(const char *name) {
+  for (int i = SCAN_SCALAR; i <= SCAN_AVX2; i++) {
+    if (strcmp(name, file_scanners[i]) == 0 && fileScannerSupported(i)) {
+      file_scanner.store(i, memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * the vector scanner for consumeFile(), nullptr for
+ * the scalar memchr() loop
+ */
+AnyOption::FileScanner AnyOption::fileScanner() {
+  switch (fileScannerIndex()) {
+  case SCAN_AVX2:
+    return scanAVX2;
+  case SCAN_SSE2:
+    return scanSSE2;
+  }
+  return nullptr;
+}
+
 void AnyOption::printVerbose() const {
   if (verbose)
     cout << endl;
@@ -322,6 +956,11 @@ void AnyOption::printVerbose(char *msg) const {
     cout << msg;
 }
 
+void AnyOption::printVerbose(const char *msg, size_t length) const {
+  if (verbose)
+    cout.write(msg, length);
+}
+
 void AnyOption::printVerbose(char ch) const {
   if (verbose)
     cout << ch;
@@ -349,142 +988,340 @@ void AnyOption::useFiileName(const char *_filename) {
  * set methods for options
  */
 
-void AnyOption::setCommandOption(const char *opt) {
+AnyOptionSlot AnyOption::setCommandOption(const char *opt) {
   addOption(opt, COMMAND_OPT);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setCommandOption(char opt) {
+AnyOptionSlot AnyOption::setCommandOption(char opt) {
   addOption(opt, COMMAND_OPT);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setCommandOption(const char *opt, char optchar) {
+AnyOptionSlot AnyOption::setCommandOption(const char *opt, char optchar) {
   addOption(opt, COMMAND_OPT);
   addOption(optchar, COMMAND_OPT);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setCommandFlag(const char *opt) {
+AnyOptionSlot AnyOption::setCommandFlag(const char *opt) {
   addOption(opt, COMMAND_FLAG);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setCommandFlag(char opt) {
+AnyOptionSlot AnyOption::setCommandFlag(char opt) {
   addOption(opt, COMMAND_FLAG);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setCommandFlag(const char *opt, char optchar) {
+AnyOptionSlot AnyOption::setCommandFlag(const char *opt, char optchar) {
   addOption(opt, COMMAND_FLAG);
   addOption(optchar, COMMAND_FLAG);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setFileOption(const char *opt) {
+AnyOptionSlot AnyOption::setFileOption(const char *opt) {
   addOption(opt, FILE_OPT);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setFileOption(char opt) {
+AnyOptionSlot AnyOption::setFileOption(char opt) {
   addOption(opt, FILE_OPT);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setFileOption(const char *opt, char optchar) {
+AnyOptionSlot AnyOption::setFileOption(const char *opt, char optchar) {
   addOption(opt, FILE_OPT);
   addOption(optchar, FILE_OPT);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setFileFlag(const char *opt) {
+AnyOptionSlot AnyOption::setFileFlag(const char *opt) {
   addOption(opt, FILE_FLAG);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setFileFlag(char opt) {
+AnyOptionSlot AnyOption::setFileFlag(char opt) {
   addOption(opt, FILE_FLAG);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setFileFlag(const char *opt, char optchar) {
+AnyOptionSlot AnyOption::setFileFlag(const char *opt, char optchar) {
   addOption(opt, FILE_FLAG);
   addOption(optchar, FILE_FLAG);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setOption(const char *opt) {
+AnyOptionSlot AnyOption::setOption(const char *opt) {
   addOption(opt, COMMON_OPT);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setOption(char opt) {
+AnyOptionSlot AnyOption::setOption(char opt) {
   addOption(opt, COMMON_OPT);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setOption(const char *opt, char optchar) {
+AnyOptionSlot AnyOption::setOption(const char *opt, char optchar) {
   addOption(opt, COMMON_OPT);
   addOption(optchar, COMMON_OPT);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setFlag(const char *opt) {
+AnyOptionSlot AnyOption::setFlag(const char *opt) {
   addOption(opt, COMMON_FLAG);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setFlag(const char opt) {
+AnyOptionSlot AnyOption::setFlag(const char opt) {
   addOption(opt, COMMON_FLAG);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::setFlag(const char *opt, char optchar) {
+AnyOptionSlot AnyOption::setFlag(const char *opt, char optchar) {
   addOption(opt, COMMON_FLAG);
   addOption(optchar, COMMON_FLAG);
-  g_value_counter++;
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::addOption(const char *opt, OptionType type) {
-  if (option_counter >= max_options) {
-    if (doubleOptStorage() == false) {
-      addOptionError(opt);
-      return;
-    }
-  }
-  options[option_counter] = opt;
-  optiontype[option_counter] = type;
-  optionindex[option_counter] = g_value_counter;
-  option_counter++;
+AnyOptionSlot AnyOption::setEnvironmentOption(const char *opt) {
+  addOption(opt, ENVIRONMENT_OPT);
+  return AnyOptionSlot(g_value_counter++);
 }
 
-void AnyOption::addOption(char opt, OptionType type) {
-  if (!POSIX()) {
-    printVerbose("Ignoring the option character \"");
-    printVerbose(opt);
-    printVerbose("\" ( POSIX options are turned off )");
-    printVerbose();
-    return;
-  }
+AnyOptionSlot AnyOption::setEnvironmentFlag(const char *opt) {
+  addOption(opt, ENVIRONMENT_FLAG);
+  return AnyOptionSlot(g_value_counter++);
+}
 
-  if (optchar_counter >= max_char_options) {
-    if (doubleCharStorage() == false) {
-      addOptionError(opt);
-      return;
+static bool isFlag(OptionType type) {
+  return type == COMMON_FLAG || type == COMMAND_FLAG || type == FILE_FLAG ||
+         type == ENVIRONMENT_FLAG;
+}
+
+bool AnyOption::setEnvironmentName(AnyOptionSlot slot, const char *env_name) {
+  EnvName name = {env_name, slot.index, false, true};
+  bool found = false;
+  for (unsigned int i = 0; i < option_counter && !found; i++) {
+    if (optionindex[i] == slot.index) {
+      name.flag = isFlag(optiontype[i]);
+      found = true;
     }
   }
-  optionchars[optchar_counter] = opt;
-  optchartype[optchar_counter] = type;
-  optcharindex[optchar_counter] = g_value_counter;
-  optchar_counter++;
+  for (unsigned int i = 0; i < optchar_counter && !found; i++) {
+    if (optcharindex[i] == slot.index) {
+      name.flag = isFlag(optchartype[i]);
+      found = true;
+    }
+  }
+  if (!found) {
+    printVerbose("No option to read from the environment variable : ");
+    printVerbose(env_name);
+    printVerbose();
+    return false;
+  }
+  if (!addEnvName(name))
+    addOptionError(env_name);
+  return true;
 }
 
-void AnyOption::addOptionError(const char *opt) const {
-  cout << endl;
-  cout << "OPTIONS ERROR : Failed allocating extra memory " << endl;
-  cout << "While adding the option : \"" << opt << "\"" << endl;
-  cout << "Exiting." << endl;
-  cout << endl;
+/*
+ * environment variable names
+ *
+ * an option named "max-width" is looked for as the variable
+ * <prefix>MAX_WIDTH, the table hashes the variable names so
+ * the environment is scanned once, with one probe per variable
+ */
+
+static inline char envChar(char c) {
+  if (c == '-' || c == '.')
+    return '_';
+  return (char)toupper((unsigned char)c);
+}
+
+/*
+ * if options of type are read from the environment by name
+ */
+bool AnyOption::envNamed(OptionType type) const {
+  return type == ENVIRONMENT_OPT || type == ENVIRONMENT_FLAG ||
+         (env_prefix != nullptr && (type == COMMON_OPT || type == COMMON_FLAG));
+}
+
+/*
+ * (re)builds the table for count names, sized to keep the
+ * load factor at or below one half, with the bound names
+ * kept and the option names taken again with the prefix
+ */
+bool AnyOption::buildEnvHash(unsigned int count) {
+  unsigned int size = 8;
+  while (size < 2 * count)
+    size <<= 1;
+  EnvName *table = (EnvName *)allocBlock(size * sizeof(EnvName));
+  if (table == nullptr)
+    return false;
+  EnvName *old = envnames;
+  unsigned int old_size = envname_size;
+  envnames = table;
+  envname_size = size;
+  envname_count = 0;
+  envname_bound = 0;
+  for (unsigned int i = 0; i < envname_size; i++)
+    envnames[i].name = nullptr;
+  for (unsigned int i = 0; i < old_size; i++) {
+    if (old[i].name != nullptr && old[i].bound)
+      hashEnvName(old[i]);
+  }
+  for (unsigned int i = 0; i < option_counter; i++) {
+    if (envNamed(optiontype[i])) {
+      EnvName name = {options[i], optionindex[i], isFlag(optiontype[i]), false};
+      hashEnvName(name);
+    }
+  }
+  freeBlock(old, old_size * sizeof(EnvName));
+  registration.allocations++;
+  registration.allocated_bytes += size * sizeof(EnvName);
+  return true;
+}
+
+/*
+ * adds a name, an option name before the option is counted
+ */
+bool AnyOption::addEnvName(const EnvName &name) {
+  if (2 * (envname_count + 1) > envname_size &&
+      !buildEnvHash(envname_count + 1))
+    return false;
+  hashEnvName(name);
+  return true;
+}
+
+void AnyOption::hashEnvName(const EnvName &name) {
+  const unsigned int mask = envname_size - 1;
+  unsigned int h = envHash(name) & mask;
+  while (envnames[h].name != nullptr)
+    h = (h + 1) & mask;
+  envnames[h] = name;
+  envname_count++;
+  if (name.bound)
+    envname_bound++;
+}
+
+/*
+ * hashString() of the variable name
+ */
+unsigned int AnyOption::envHash(const EnvName &name) const {
+  if (name.bound)
+    return hashString(name.name, strlen(name.name));
+  unsigned int h = 2166136261u;
+  for (const char *c = env_prefix; c != nullptr && *c != '\0'; c++) {
+    h ^= (unsigned char)*c;
+    h *= 16777619u;
+  }
+  for (const char *c = name.name; *c != '\0'; c++) {
+    h ^= (unsigned char)envChar(*c);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/*
+ * if var[0..length) is the variable name
+ */
+bool AnyOption::envMatch(const EnvName &name, const char *var,
+                         size_t length) const {
+  if (name.bound)
+    return strncmp(name.name, var, length) == 0 && name.name[length] == '\0';
+  size_t prefix_length = env_prefix != nullptr ? strlen(env_prefix) : 0;
+  if (length < prefix_length || memcmp(var, env_prefix, prefix_length) != 0)
+    return false;
+  const char *c = name.name;
+  for (size_t i = prefix_length; i < length; i++, c++) {
+    if (*c == '\0' || envChar(*c) != var[i])
+      return false;
+  }
+  return *c == '\0';
+}
+
+/*
+ * registers the table entries in order, one value slot each
+ */
+void AnyOption::setOptions(const AnyOptionDecl *table, unsigned int count) {
+  for (unsigned int i = 0; i < count; i++) {
+    if (table[i].name != nullptr)
+      addOption(table[i].name, table[i].type);
+    if (table[i].optchar != 0)
+      addOption(table[i].optchar, table[i].type);
+    g_value_counter++;
+  }
+}
+
+void AnyOption::addOption(const char *opt, OptionType type) {
+  unsigned long long start = startPhase();
+  if (option_counter >= max_options) {
+    if (doubleOptStorage() == false) {
+      addOptionError(opt);
+      return;
+    }
+  }
+  options[option_counter] = opt;
+  optiontype[option_counter] = type;
+  optionindex[option_counter] = g_value_counter;
+  optionnext[option_counter] = -1;
+  hashOption(option_counter);
+  if (envNamed(type)) {
+    EnvName name = {opt, (int)g_value_counter, isFlag(type), false};
+    if (!addEnvName(name)) {
+      addOptionError(opt);
+      return;
+    }
+  }
+  if (trie != nullptr && isCommand(type) && !trieOption(option_counter)) {
+    addOptionError(opt);
+    return;
+  }
+  option_counter++;
+  if (instrument)
+    registration.register_ns += nowNs() - start;
+}
+
+void AnyOption::addOption(char opt, OptionType type) {
+  if (!POSIX()) {
+    printVerbose("Ignoring the option character \"");
+    printVerbose(opt);
+    printVerbose("\" ( POSIX options are turned off )");
+    printVerbose();
+    return;
+  }
+
+  unsigned long long start = startPhase();
+  if (optchar_counter >= max_char_options) {
+    if (doubleCharStorage() == false) {
+      addOptionError(opt);
+      return;
+    }
+  }
+  optionchars[optchar_counter] = opt;
+  optchartype[optchar_counter] = type;
+  optcharindex[optchar_counter] = g_value_counter;
+  optcharnext[optchar_counter] = -1;
+  int i = findChar(opt);
+  if (i < 0) {
+    optcharmap[(unsigned char)opt] = optchar_counter;
+  } else { /* same char, chain it */
+    while (optcharnext[i] != -1)
+      i = optcharnext[i];
+    optcharnext[i] = optchar_counter;
+  }
+  optchar_counter++;
+  if (instrument)
+    registration.register_ns += nowNs() - start;
+}
+
+void AnyOption::addOptionError(const char *opt) const {
+  cout << endl;
+  cout << "OPTIONS ERROR : Failed allocating extra memory " << endl;
+  cout << "While adding the option : \"" << opt << "\"" << endl;
+  cout << "Exiting." << endl;
+  cout << endl;
   exit(0);
 }
 
@@ -518,60 +1355,272 @@ void AnyOption::processCommandArgs(int _argc, char **_argv) {
 }
 
 void AnyOption::processCommandArgs() {
-  new_argc = 0;
+  parsed.new_argc = 0;
   if (!(valueStoreOK() && CommandSet()))
     return;
 
-  if (max_legal_args == 0)
-    max_legal_args = argc;
-  new_argv = new int[max_legal_args + 1];
-  for (int i = 1; i < argc; i++) { /* ignore first argv */
-    if (argv[i][0] == long_opt_prefix[0] &&
-        argv[i][1] == long_opt_prefix[1]) { /* long GNU option */
-      int match_at = parseGNU(argv[i] + 2); /* skip -- */
-      if (match_at >= 0 && i < argc - 1)    /* found match */
-        setValue(options[match_at], argv[++i]);
-    } else if (argv[i][0] == opt_prefix_char) { /* POSIX char */
+  parseCommandArgs(argc, argv, max_legal_args, parsed);
+  answerCompletion();
+}
+
+/*
+ * the classic versions answer a shell asking for completions
+ */
+void AnyOption::answerCompletion() const {
+  if (parsed.completion == nullptr)
+    return;
+  complete(parsed.completion, cout);
+  cout.flush();
+  exit(0);
+}
+
+void AnyOption::processCommandArgs(int _argc, char **_argv,
+                                   AnyOptionResult &result) const {
+  processCommandArgs(_argc, _argv, 0, result);
+}
+
+void AnyOption::processCommandArgs(int _argc, char **_argv, int max_args,
+                                   AnyOptionResult &result) const {
+  if (!result.prepare(this))
+    return;
+  if (_argc > 1)
+    result.hasoptions = true;
+  parseCommandArgs(_argc, _argv, max_args, result);
+}
+
+void AnyOption::parseCommandArgs(int _argc, char **_argv,
+                                 unsigned int max_args,
+                                 AnyOptionResult &result) const {
+  unsigned long long start = startPhase();
+  if (max_args == 0) /* no limit */
+    max_args = UINT_MAX;
+  result.argv = _argv;
+  result.completion = nullptr;
+  result.new_argc = 0;
+  result.new_argv_size = _argc > 1 ? _argc : 1;
+  result.new_argv =
+      (char **)result.arenaAlloc(result.new_argv_size * sizeof(char *));
+  ArgCursor cursor;
+  cursor.argv = _argv;
+  cursor.argc = _argc;
+  cursor.next = 1; /* ignore first argv */
+  cursor.depth = 0;
+  char *value = nullptr;
+  for (char *arg = nextArg(cursor, result); arg != nullptr;
+       arg = nextArg(cursor, result)) {
+    if (arg[0] == long_opt_prefix[0] &&
+        arg[1] == long_opt_prefix[1]) { /* long GNU option */
+      if (completion_option != nullptr &&
+          strcmp(arg + 2, completion_option) == 0) { /* a shell asking */
+        value = nextArg(cursor, result);
+        result.completion = value != nullptr ? value : "";
+        break; /* the rest is still being typed */
+      }
+      int match_at = parseGNU(arg + 2, result); /* skip -- */
+      if (match_at >= 0 && (value = nextArg(cursor, result)) != nullptr)
+        setCommandValue(optionindex[match_at], value, result); /* found match */
+    } else if (arg[0] == opt_prefix_char) { /* POSIX char */
       if (POSIX()) {
-        char ch = parsePOSIX(argv[i] + 1); /* skip - */
-        if (ch != '0' && i < argc - 1)     /* matching char */
-          setValue(ch, argv[++i]);
+        char ch = parsePOSIX(arg + 1, result); /* skip - */
+        if (ch != '0' && (value = nextArg(cursor, result)) != nullptr)
+          setValue(ch, value, result); /* matching char */
       } else { /* treat it as GNU option with a - */
-        int match_at = parseGNU(argv[i] + 1); /* skip - */
-        if (match_at >= 0 && i < argc - 1)    /* found match */
-          setValue(options[match_at], argv[++i]);
-      }
-    } else { /* not option but an argument keep index */
-      if (new_argc < max_legal_args) {
-        new_argv[new_argc] = i;
-        new_argc++;
-      } else { /* ignore extra arguments */
-        printVerbose("Ignoring extra argument: ");
-        printVerbose(argv[i]);
-        printVerbose();
-        printAutoUsage();
+        int match_at = parseGNU(arg + 1, result); /* skip - */
+        if (match_at >= 0 && (value = nextArg(cursor, result)) != nullptr)
+          setCommandValue(optionindex[match_at], value, result); /* found match */
       }
+    } else { /* not option but an argument keep it */
+      addArgument(arg, max_args, result);
       printVerbose("Unknown command argument option : ");
-      printVerbose(argv[i]);
+      printVerbose(arg);
+      printVerbose();
+      printAutoUsage(result);
+    }
+  }
+  finishPhase(PARSE_COMMAND, start, result);
+}
+
+void AnyOption::addArgument(char *arg, unsigned int max_args,
+                            AnyOptionResult &result) const {
+  if (result.new_argc >= max_args) { /* ignore extra arguments */
+    printVerbose("Ignoring extra argument: ");
+    printVerbose(arg);
+    printVerbose();
+    printAutoUsage(result);
+    return;
+  }
+  if (result.new_argc == result.new_argv_size) { /* more from response files */
+    char **grown = (char **)result.arenaAlloc(2 * result.new_argv_size *
+                                              sizeof(char *));
+    memcpy(grown, result.new_argv, result.new_argc * sizeof(char *));
+    result.new_argv = grown;
+    result.new_argv_size *= 2;
+  }
+  result.new_argv[result.new_argc++] = arg;
+}
+
+/*
+ * the next argument from argv or the innermost response
+ * file, nullptr after the last one
+ */
+char *AnyOption::nextArg(ArgCursor &cursor, AnyOptionResult &result) const {
+  for (;;) {
+    char *arg = nullptr;
+    if (cursor.depth > 0) {
+      ArgCursor::Response &response = cursor.responses[cursor.depth - 1];
+      if (response.left == 0) { /* back to the including file */
+        cursor.depth--;
+        continue;
+      }
+      arg = response.next;
+      response.next += strlen(arg) + 1;
+      response.left--;
+    } else if (cursor.next < cursor.argc) {
+      arg = cursor.argv[cursor.next++];
+    } else {
+      return nullptr;
+    }
+    if (!response_files || arg[0] != '@' || arg[1] == nullterminate)
+      return arg;
+    if (cursor.depth == RESPONSE_FILE_DEPTH) {
+      printVerbose("Response files nested too deep : ");
+      printVerbose(arg);
       printVerbose();
-      printAutoUsage();
+      return arg;
+    }
+    size_t count = 0;
+    char *args = readResponseFile(arg + 1, count, result);
+    if (args == nullptr) /* not a file, an argument */
+      return arg;
+    cursor.responses[cursor.depth].next = args;
+    cursor.responses[cursor.depth].left = count;
+    cursor.depth++;
+  }
+}
+
+/* white space and quoting in response files */
+static const unsigned char RESPONSE_SPACE = 1;
+static const unsigned char RESPONSE_QUOTING = 2;
+
+struct ResponseClasses {
+  unsigned char of[256];
+  ResponseClasses() {
+    memset(of, 0, sizeof(of));
+    for (const char *c = " \t\n\r\v\f"; *c != '\0'; c++)
+      of[(unsigned char)*c] = RESPONSE_SPACE;
+    of[0] = RESPONSE_SPACE;
+    of[(unsigned char)'\''] = RESPONSE_QUOTING;
+    of[(unsigned char)'"'] = RESPONSE_QUOTING;
+    of[(unsigned char)'\\'] = RESPONSE_QUOTING;
+  }
+};
+
+/*
+ * splits a response file in place into count null
+ * terminated arguments, one after the other, text
+ * has room for the terminator after length
+ */
+static size_t splitResponse(char *text, size_t length) {
+  static const ResponseClasses classes;
+  size_t count = 0;
+  char *out = text;
+  size_t i = 0;
+  for (;;) {
+    while (i < length && classes.of[(unsigned char)text[i]] == RESPONSE_SPACE)
+      i++;
+    if (i == length)
+      return count;
+    char quote = 0;
+    while (i < length) {
+      if (quote == 0) { /* move a run of plain characters at once */
+        size_t run = i;
+        while (run < length && classes.of[(unsigned char)text[run]] == 0)
+          run++;
+        if (out != text + i)
+          memmove(out, text + i, run - i);
+        out += run - i;
+        i = run;
+        if (i == length || classes.of[(unsigned char)text[i]] == RESPONSE_SPACE)
+          break;
+      }
+      char c = text[i++];
+      if (quote == '\'') { /* everything is literal till the quote */
+        if (c == '\'')
+          quote = 0;
+        else
+          *out++ = c;
+      } else if (c == '\\' && i < length) {
+        *out++ = text[i++];
+      } else if (quote == '"' && c == '"') {
+        quote = 0;
+      } else if (quote == 0 && (c == '\'' || c == '"')) {
+        quote = c;
+      } else {
+        *out++ = c;
+      }
     }
+    if (i < length) /* the separator, out stays behind i */
+      i++;
+    *out++ = '\0';
+    count++;
+  }
+}
+
+/*
+ * reads a response file into the result and splits it,
+ * the arguments live as long as the values do
+ */
+char *AnyOption::readResponseFile(const char *fname, size_t &count,
+                                  AnyOptionResult &result) const {
+  struct stat st; /* a directory can be opened but not sized */
+  if (stat(fname, &st) != 0 || (st.st_mode & S_IFMT) == S_IFDIR)
+    return nullptr;
+  ifstream is(fname, ifstream::in | ifstream::binary);
+  if (!is.good())
+    return nullptr;
+  size_t length = 0;
+  char *text = nullptr;
+  if ((st.st_mode & S_IFMT) == S_IFREG) { /* read it in one go */
+    if ((unsigned long long)st.st_size >= SIZE_MAX)
+      return nullptr;
+    length = (size_t)st.st_size;
+    text = (char *)result.arenaTryAlloc(length + 1);
+    if (text == nullptr)
+      return nullptr;
+    is.read(text, length);
+    length = (size_t)is.gcount();
+  } else { /* a pipe, read it in chunks */
+    is.clear();
+    string piped;
+    do {
+      piped.resize(length + DEFAULT_STREAM_CHUNK);
+      is.read(&piped[length], DEFAULT_STREAM_CHUNK);
+      length += (size_t)is.gcount();
+    } while (is.good());
+    text = (char *)result.arenaTryAlloc(length + 1);
+    if (text == nullptr)
+      return nullptr;
+    memcpy(text, piped.data(), length);
   }
+  text[length] = nullterminate;
+  count = splitResponse(text, length);
+  return text;
 }
 
-char AnyOption::parsePOSIX(char *arg) {
+char AnyOption::parsePOSIX(char *arg, AnyOptionResult &result) const {
 
-  for (unsigned int i = 0; i < strlen(arg); i++) {
+  const size_t length = strlen(arg);
+  for (size_t i = 0; i < length; i++) {
     char ch = arg[i];
-    if (matchChar(ch)) { /* keep matching flags till an option */
+    if (matchChar(ch, result)) { /* keep matching flags till an option */
       /*if last char argv[++i] is the value */
-      if (i == strlen(arg) - 1) {
+      if (i == length - 1) {
         return ch;
       } else { /* else the rest of arg is the value */
         i++;   /* skip any '=' and ' ' */
         while (arg[i] == whitespace || arg[i] == equalsign)
           i++;
-        setValue(ch, arg + i);
+        setValue(ch, arg + i, result);
         return '0';
       }
     }
@@ -579,94 +1628,88 @@ char AnyOption::parsePOSIX(char *arg) {
   printVerbose("Unknown command argument option : ");
   printVerbose(arg);
   printVerbose();
-  printAutoUsage();
+  printAutoUsage(result);
   return '0';
 }
 
-int AnyOption::parseGNU(char *arg) {
+int AnyOption::parseGNU(char *arg, AnyOptionResult &result) const {
   size_t split_at = 0;
   /* if has a '=' sign get value */
-  for (size_t i = 0; i < strlen(arg); i++) {
-    if (arg[i] == equalsign) {
-      split_at = i;    /* store index */
-      i = strlen(arg); /* get out of loop */
-    }
-  }
+  const char *split = strchr(arg, equalsign);
+  if (split != nullptr)
+    split_at = split - arg; /* store index */
   if (split_at > 0) { /* it is an option value pair */
-    char *tmp = new char[split_at + 1];
-    for (size_t i = 0; i < split_at; i++)
-      tmp[i] = arg[i];
-    tmp[split_at] = '\0';
-
-    if (matchOpt(tmp) >= 0) {
-      setValue(options[matchOpt(tmp)], arg + split_at + 1);
-      delete[] tmp;
-      tmp = nullptr;
+    int match_at = matchOpt(arg, split_at, result);
+    if (match_at >= 0) {
+      setCommandValue(optionindex[match_at], arg + split_at + 1, result);
     } else {
       printVerbose("Unknown command argument option : ");
       printVerbose(arg);
       printVerbose();
-      printAutoUsage();
-      delete[] tmp;
-      tmp = nullptr;
+      printAutoUsage(result);
       return -1;
     }
   } else { /* regular options with no '=' sign  */
-    return matchOpt(arg);
+    return matchOpt(arg, strlen(arg), result);
   }
   return -1;
 }
 
-int AnyOption::matchOpt(char *opt) {
-  for (unsigned int i = 0; i < option_counter; i++) {
-    if (strcmp(options[i], opt) == 0) {
-      if (optiontype[i] == COMMON_OPT ||
-          optiontype[i] == COMMAND_OPT) { /* found option return index */
-        return i;
-      } else if (optiontype[i] == COMMON_FLAG ||
-                 optiontype[i] == COMMAND_FLAG) { /* found flag, set it */
-        setFlagOn(opt);
-        return -1;
-      }
+int AnyOption::matchOpt(const char *opt, size_t length,
+                        AnyOptionResult &result) const {
+  result.stats.lookups++; /* the hash probe */
+  int first = findOption(opt, length);
+  if (first < 0 && abbreviate)
+    first = findAbbreviation(opt, length, result);
+  if (first == -2) {
+    printVerbose("Ambiguous command argument option : ");
+    printVerbose(opt, length);
+    printVerbose();
+    printAutoUsage(result);
+    return -1;
+  }
+  for (int i = first; i >= 0; i = optionnext[i]) {
+    result.stats.lookups++;
+    if (optiontype[i] == COMMON_OPT ||
+        optiontype[i] == COMMAND_OPT) { /* found option return index */
+      return i;
+    } else if (optiontype[i] == COMMON_FLAG ||
+               optiontype[i] == COMMAND_FLAG) { /* found flag, set it */
+      result.storeFlag(optionindex[i]);
+      return -1;
     }
   }
   printVerbose("Unknown command argument option : ");
-  printVerbose(opt);
+  printVerbose(opt, length);
   printVerbose();
-  printAutoUsage();
+  printAutoUsage(result);
   return -1;
 }
-bool AnyOption::matchChar(char c) {
-  for (unsigned int i = 0; i < optchar_counter; i++) {
-    if (optionchars[i] == c) { /* found match */
-      if (optchartype[i] == COMMON_OPT ||
-          optchartype[i] ==
-              COMMAND_OPT) { /* an option store and stop scanning */
-        return true;
-      } else if (optchartype[i] == COMMON_FLAG ||
-                 optchartype[i] ==
-                     COMMAND_FLAG) { /* a flag store and keep scanning */
-        setFlagOn(c);
-        return false;
-      }
+bool AnyOption::matchChar(char c, AnyOptionResult &result) const {
+  result.stats.lookups++; /* the char map */
+  for (int i = findChar(c); i >= 0; i = optcharnext[i]) {
+    result.stats.lookups++;
+    if (optchartype[i] == COMMON_OPT ||
+        optchartype[i] == COMMAND_OPT) { /* an option store and stop scanning */
+      return true;
+    } else if (optchartype[i] == COMMON_FLAG ||
+               optchartype[i] ==
+                   COMMAND_FLAG) { /* a flag store and keep scanning */
+      result.storeFlag(optcharindex[i]);
+      return false;
     }
   }
   printVerbose("Unknown command argument option : ");
   printVerbose(c);
   printVerbose();
-  printAutoUsage();
+  printAutoUsage(result);
   return false;
 }
 
 bool AnyOption::valueStoreOK() {
   if (!set) {
-    if (g_value_counter > 0) {
-      const unsigned int size = g_value_counter * sizeof(char *);
-      values = new char *[size];
-      for (unsigned int i = 0; i < g_value_counter; i++)
-        values[i] = nullptr;
-      set = true;
-    }
+    if (g_value_counter > 0)
+      set = parsed.prepare(this);
   }
   return set;
 }
@@ -675,122 +1718,197 @@ bool AnyOption::valueStoreOK() {
  * public get methods
  */
 char *AnyOption::getValue(const char *option) {
-  if (!valueStoreOK())
+  if (!set) /* nothing processed, nothing to allocate */
     return nullptr;
-
-  for (unsigned int i = 0; i < option_counter; i++) {
-    if (strcmp(options[i], option) == 0)
-      return values[optionindex[i]];
-  }
-  return nullptr;
+  return parsed.getValue(option);
 }
 
 bool AnyOption::getFlag(const char *option) {
-  if (!valueStoreOK())
+  if (!set)
     return false;
-  for (unsigned int i = 0; i < option_counter; i++) {
-    if (strcmp(options[i], option) == 0)
-      return findFlag(values[optionindex[i]]);
-  }
-  return false;
+  return parsed.getFlag(option);
 }
 
 char *AnyOption::getValue(char option) {
-  if (!valueStoreOK())
+  if (!set)
     return nullptr;
-  for (unsigned int i = 0; i < optchar_counter; i++) {
-    if (optionchars[i] == option)
-      return values[optcharindex[i]];
-  }
-  return nullptr;
+  return parsed.getValue(option);
 }
 
 bool AnyOption::getFlag(char option) {
-  if (!valueStoreOK())
+  if (!set)
     return false;
-  for (unsigned int i = 0; i < optchar_counter; i++) {
-    if (optionchars[i] == option)
-      return findFlag(values[optcharindex[i]]);
-  }
-  return false;
+  return parsed.getFlag(option);
 }
 
-bool AnyOption::findFlag(char *val) {
-  if (val == nullptr)
+const char *AnyOption::getValue(const char *option, size_t &length) {
+  if (!set)
+    return nullptr;
+  return parsed.getValue(option, length);
+}
+
+const char *AnyOption::getValue(char option, size_t &length) {
+  if (!set)
+    return nullptr;
+  return parsed.getValue(option, length);
+}
+
+char *AnyOption::getValue(AnyOptionSlot slot) {
+  if (!set)
+    return nullptr;
+  return parsed.getValue(slot);
+}
+
+bool AnyOption::getFlag(AnyOptionSlot slot) {
+  if (!set)
     return false;
+  return parsed.getFlag(slot);
+}
 
-  if (strcmp(TRUE_FLAG, val) == 0)
-    return true;
+ValueStatus AnyOption::getInt(const char *option, long long &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getInt(option, value);
+}
 
-  return false;
+ValueStatus AnyOption::getInt(char option, long long &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getInt(option, value);
+}
+
+ValueStatus AnyOption::getInt(AnyOptionSlot slot, long long &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getInt(slot, value);
+}
+
+ValueStatus AnyOption::getDouble(const char *option, double &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getDouble(option, value);
+}
+
+ValueStatus AnyOption::getDouble(char option, double &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getDouble(option, value);
+}
+
+ValueStatus AnyOption::getDouble(AnyOptionSlot slot, double &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getDouble(slot, value);
+}
+
+ValueStatus AnyOption::getBool(const char *option, bool &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getBool(option, value);
+}
+
+ValueStatus AnyOption::getBool(char option, bool &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getBool(option, value);
+}
+
+ValueStatus AnyOption::getBool(AnyOptionSlot slot, bool &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getBool(slot, value);
+}
+
+ValueStatus AnyOption::getSize(const char *option, unsigned long long &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getSize(option, value);
+}
+
+ValueStatus AnyOption::getSize(char option, unsigned long long &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getSize(option, value);
+}
+
+ValueStatus AnyOption::getSize(AnyOptionSlot slot, unsigned long long &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getSize(slot, value);
+}
+
+ValueStatus AnyOption::getDuration(const char *option, long long &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getDuration(option, value);
+}
+
+ValueStatus AnyOption::getDuration(char option, long long &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getDuration(option, value);
+}
+
+ValueStatus AnyOption::getDuration(AnyOptionSlot slot, long long &value) {
+  if (!set)
+    return VALUE_NOT_SET;
+  return parsed.getDuration(slot, value);
 }
 
 /*
- * private set methods
+ * index into value storage for an option, when the
+ * name was registered more than once ( for example as
+ * a file option and as a command flag ) the first one
+ * holding a value
  */
-bool AnyOption::setValue(const char *option, char *value) {
-  if (!valueStoreOK())
-    return false;
-  for (unsigned int i = 0; i < option_counter; i++) {
-    if (strcmp(options[i], option) == 0) {
-      size_t length = (strlen(value) + 1) * sizeof(char);
-      allocValues(optionindex[i], length);
-      strncpy(values[optionindex[i]], value, length);
-      return true;
-    }
+int AnyOption::valueIndex(const char *option,
+                          const AnyOptionResult &result) const {
+  int first = findOption(option);
+  for (int i = first; i >= 0; i = optionnext[i]) {
+    if (result.hasValue(optionindex[i]))
+      return optionindex[i];
   }
-  return false;
+  return first >= 0 ? optionindex[first] : -1;
 }
 
-bool AnyOption::setFlagOn(const char *option) {
-  if (!valueStoreOK())
-    return false;
-  for (unsigned int i = 0; i < option_counter; i++) {
-    if (strcmp(options[i], option) == 0) {
-      size_t length = (strlen(TRUE_FLAG) + 1) * sizeof(char);
-      allocValues(optionindex[i], length);
-      strncpy(values[optionindex[i]], TRUE_FLAG, length);
-      return true;
-    }
+int AnyOption::valueIndex(char optchar, const AnyOptionResult &result) const {
+  int first = findChar(optchar);
+  for (int i = first; i >= 0; i = optcharnext[i]) {
+    if (result.hasValue(optcharindex[i]))
+      return optcharindex[i];
   }
-  return false;
+  return first >= 0 ? optcharindex[first] : -1;
 }
 
-bool AnyOption::setValue(char option, char *value) {
-  if (!valueStoreOK())
-    return false;
-  for (unsigned int i = 0; i < optchar_counter; i++) {
-    if (optionchars[i] == option) {
-      size_t length = (strlen(value) + 1) * sizeof(char);
-      allocValues(optcharindex[i], length);
-      strncpy(values[optcharindex[i]], value, length);
-      return true;
-    }
+/*
+ * private set methods
+ */
+bool AnyOption::setValue(char option, char *value,
+                         AnyOptionResult &result) const {
+  int i = findChar(option);
+  if (i >= 0) {
+    setCommandValue(optcharindex[i], value, result);
+    return true;
   }
   return false;
 }
 
-bool AnyOption::setFlagOn(char option) {
-  if (!valueStoreOK())
-    return false;
-  for (unsigned int i = 0; i < optchar_counter; i++) {
-    if (optionchars[i] == option) {
-      size_t length = (strlen(TRUE_FLAG) + 1) * sizeof(char);
-      allocValues(optcharindex[i], length);
-      strncpy(values[optcharindex[i]], TRUE_FLAG, length);
-      return true;
-    }
-  }
-  return false;
+/*
+ * command line values are copied, or refer to argv
+ * without copying when borrowing argv
+ */
+void AnyOption::setCommandValue(int index, char *value,
+                                AnyOptionResult &result) const {
+  if (borrow_argv)
+    result.storeBorrowedValue(index, value);
+  else
+    result.storeValue(index, value, strlen(value));
 }
 
-int AnyOption::getArgc() const { return new_argc; }
+int AnyOption::getArgc() const { return parsed.getArgc(); }
 
 char *AnyOption::getArgv(unsigned int index) const {
-  if (index < new_argc) {
-    return (argv[new_argv[index]]);
-  }
-  return nullptr;
+  return parsed.getArgv(index);
 }
 
 /* option file sub routines */
@@ -798,7 +1916,7 @@ char *AnyOption::getArgv(unsigned int index) const {
 bool AnyOption::processFile() {
   if (!(valueStoreOK() && FileSet()))
     return false;
-  return hasoptions = (consumeFile(readFile()));
+  return hasoptions = (parseFile(filename, parsed));
 }
 
 bool AnyOption::processFile(const char *_filename) {
@@ -806,210 +1924,2328 @@ bool AnyOption::processFile(const char *_filename) {
   return (processFile());
 }
 
-char *AnyOption::readFile() { return (readFile(filename)); }
+bool AnyOption::processFile(const char *_filename,
+                            AnyOptionResult &result) const {
+  if (!result.prepare(this))
+    return false;
+  if (parseFile(_filename, result))
+    return result.hasoptions = true;
+  return false;
+}
 
-/*
- * read the file contents to a character buffer
- */
+bool AnyOption::processLayers(const char *const *files, unsigned int count) {
+  if (!valueStoreOK())
+    return false;
+  bool layered = processLayers(files, count, CommandSet() ? argc : 0,
+                               CommandSet() ? argv : nullptr, parsed);
+  answerCompletion();
+  hasoptions = hasoptions || layered;
+  return layered;
+}
 
-char *AnyOption::readFile(const char *fname) {
-  char *buffer;
+bool AnyOption::processLayers(const char *const *files, unsigned int count,
+                              int _argc, char **_argv,
+                              AnyOptionResult &result) const {
+  if (!result.prepare(this))
+    return false;
+  AnyOptionResult *layers = newParts(count);
+  if (layers == nullptr)
+    return false;
+
+  unsigned long long start = startPhase();
+  vector<char> found(count, 0);
+  vector<char *> buffers(count, nullptr);
+  vector<size_t> lengths(count, 0);
+  /* a worker per core at most, sharing the file threads */
+  const unsigned int cores = max(1u, thread::hardware_concurrency());
+  const unsigned int workers = min(count, cores);
+  const unsigned int budget =
+      max(1u, (file_threads == 0 ? cores : file_threads) / max(1u, workers));
+  auto parse = [&](unsigned int i) {
+    if (!layers[i].prepare(this))
+      return;
+    layers[i].file_threads = budget;
+    struct stat st;
+    if (map_file || file_cache || stat(files[i], &st) != 0 ||
+        (st.st_mode & S_IFMT) != S_IFREG) { /* mapped, cached or a pipe */
+      found[i] = parseSource(files[i], layers[i]);
+      return;
+    }
+    buffers[i] = readFile(files[i], lengths[i]);
+    if (buffers[i] == nullptr)
+      return;
+    layers[i].stats.allocations++;
+    layers[i].stats.allocated_bytes += lengths[i] + 1;
+    layers[i].stats.file_bytes += lengths[i];
+    layers[i].mapped_file = buffers[i]; /* values stay in the buffer */
+    layers[i].mapped_length = lengths[i];
+    if (!file_includes) {
+      found[i] = consumeFile(buffers[i], lengths[i], layers[i]);
+      return;
+    }
+    AnyOptionIncludeFrame frame(canonicalPath(files[i]), layers[i].including);
+    layers[i].including = &frame; /* includes relative to the layer */
+    found[i] = consumeFile(buffers[i], lengths[i], layers[i]);
+    layers[i].including = frame.parent;
+  };
+  atomic<unsigned int> next(0);
+  auto work = [&]() {
+    for (unsigned int i = next++; i < count; i = next++)
+      parse(i);
+  };
+  if (workers < 2) {
+    work();
+  } else { /* the layers don't depend on each other */
+    vector<thread> helpers;
+    for (unsigned int i = 1; i < workers; i++)
+      helpers.push_back(thread(work));
+    work();
+    for (thread &helper : helpers)
+      helper.join();
+  }
+  resolveParts(layers, count, result);
+  for (unsigned int i = 0; i < count; i++) {
+    if (buffers[i] == nullptr)
+      continue;
+    layers[i].mapped_file = nullptr; /* not a mapping */
+    layers[i].mapped_length = 0;
+    freeBlock(buffers[i], lengths[i] + 1);
+  }
+  deleteParts(layers, count);
+  finishPhase(PARSE_FILE, start, result);
+
+  parseEnvironment(environ, result); /* when options are bound to it */
+  if (_argc > 0 && _argv != nullptr) /* the command line on top */
+    parseCommandArgs(_argc, _argv, max_legal_args, result);
+  bool layered = find(found.begin(), found.end(), 1) != found.end();
+  if (layered || _argc > 1)
+    result.hasoptions = true;
+  return layered;
+}
+
+/* environment sub routines */
+
+bool AnyOption::processEnvironment() {
+  if (!valueStoreOK())
+    return false;
+  bool found = parseEnvironment(environ, parsed);
+  hasoptions = hasoptions || found;
+  return found;
+}
+
+bool AnyOption::processEnvironment(AnyOptionResult &result) const {
+  return processEnvironment(environ, result);
+}
+
+bool AnyOption::processEnvironment(char **envp, AnyOptionResult &result) const {
+  if (!result.prepare(this))
+    return false;
+  return parseEnvironment(envp, result);
+}
+
+/*
+ * one pass over the NAME=value strings, the names bound
+ * to options found by hash, unrelated variables cost a
+ * probe, or only a prefix compare when no name is bound
+ */
+bool AnyOption::parseEnvironment(char **envp, AnyOptionResult &result) const {
+  if (envname_count == 0 || envp == nullptr)
+    return false;
+  bool found = false;
+  unsigned long long start = startPhase();
+  const size_t prefix_length = env_prefix != nullptr ? strlen(env_prefix) : 0;
+  const unsigned int mask = envname_size - 1;
+  for (char **var = envp; *var != nullptr; var++) {
+    if (envname_bound == 0 && prefix_length > 0 &&
+        strncmp(*var, env_prefix, prefix_length) != 0) /* not ours */
+      continue;
+    const char *equals = strchr(*var, equalsign);
+    if (equals == nullptr)
+      continue;
+    size_t length = equals - *var;
+    result.stats.lookups++; /* the hash probe */
+    for (unsigned int h = hashString(*var, length) & mask;
+         envnames[h].name != nullptr; h = (h + 1) & mask) {
+      result.stats.lookups++;
+      if (envMatch(envnames[h], *var, length)) { /* names can repeat */
+        setEnvironmentValue(envnames[h], *var, length, result);
+        found = true;
+      }
+    }
+  }
+  finishPhase(PARSE_ENVIRONMENT, start, result);
+  if (found)
+    result.hasoptions = true;
+  return found;
+}
+
+/*
+ * values are copied, the environment can change later,
+ * a flag is set or cleared by its boolean value
+ */
+void AnyOption::setEnvironmentValue(const EnvName &name, const char *var,
+                                    size_t length,
+                                    AnyOptionResult &result) const {
+  const char *value = var + length + 1;
+  if (!name.flag) {
+    result.storeValue(name.value, value, strlen(value));
+    return;
+  }
+  bool on = false;
+  if (AnyOptionResult::parseBool(value, on) != VALUE_OK) {
+    printVerbose("Invalid flag value in environment : ");
+    printVerbose(var);
+    printVerbose();
+  } else if (on) {
+    result.storeFlag(name.value);
+  } else {
+    result.forgetValue(name.value);
+  }
+}
+
+bool AnyOption::parseFile(const char *fname, AnyOptionResult &result) const {
+  unsigned long long start = startPhase();
+  bool parsed = parseSource(fname, result);
+  finishPhase(PARSE_FILE, start, result);
+  return parsed;
+}
+
+bool AnyOption::parseSource(const char *fname, AnyOptionResult &result) const {
+  if (file_includes) { /* included files are not in the cache */
+    AnyOptionIncludeFrame frame(canonicalPath(fname), result.including);
+    result.including = &frame;
+    bool parsed = readOrMapFile(fname, result);
+    result.including = frame.parent;
+    return parsed;
+  }
+  if (file_cache)
+    return parseCached(fname, result);
+  return readOrMapFile(fname, result);
+}
+
+bool AnyOption::readOrMapFile(const char *fname, AnyOptionResult &result) const {
+  if (map_file && mapFile(fname, result)) {
+    result.stats.file_bytes += result.mapped_length;
+    return consumeFile(result.mapped_file, result.mapped_length, result);
+  }
+  ifstream is(fname, ifstream::in);
+  if (!is.good())
+    return false;
+  size_t length = 0;
+  char *buffer = readFile(is, length);
+  if (buffer == nullptr) /* a pipe we can't size */
+    return consumeStream(readStream, &is, result);
+  result.stats.allocations++;
+  result.stats.allocated_bytes += length + 1;
+  result.stats.file_bytes += length;
+  bool consumed = consumeFile(buffer, length, result);
+  freeBlock(buffer, length + 1);
+  return consumed;
+}
+
+bool AnyOption::processStream(istream &in) {
+  if (!valueStoreOK())
+    return false;
+  return hasoptions = processStream(in, parsed);
+}
+
+bool AnyOption::processStream(int fd) {
+  if (!valueStoreOK())
+    return false;
+  return hasoptions = processStream(fd, parsed);
+}
+
+bool AnyOption::processStream(istream &in, AnyOptionResult &result) const {
+  if (!in.good() || !result.prepare(this))
+    return false;
+  unsigned long long start = startPhase();
+  bool consumed = consumeStream(readStream, &in, result);
+  finishPhase(PARSE_FILE, start, result);
+  if (consumed)
+    return result.hasoptions = true;
+  return false;
+}
+
+bool AnyOption::processStream(int fd, AnyOptionResult &result) const {
+  if (fd < 0 || !result.prepare(this))
+    return false;
+  unsigned long long start = startPhase();
+  bool consumed = consumeStream(readDescriptor, &fd, result);
+  finishPhase(PARSE_FILE, start, result);
+  if (consumed)
+    return result.hasoptions = true;
+  return false;
+}
+
+/*
+ * read the file contents to a character buffer
+ */
+
+char *AnyOption::readFile(const char *fname, size_t &length) const {
   ifstream is;
   is.open(fname, ifstream::in);
   if (!is.good()) {
     is.close();
     return nullptr;
   }
+  char *buffer = readFile(is, length);
+  is.close();
+  return buffer;
+}
+
+/*
+ * returns nullptr if the stream can't be sized, like a pipe,
+ * which is left at its start for consumeStream()
+ */
+char *AnyOption::readFile(istream &is, size_t &length) const {
+  char *buffer;
   is.seekg(0, ios::end);
-  size_t length = (size_t)is.tellg();
+  streamoff end = is.tellg();
+  if (end < 0) { /* not seekable */
+    is.clear();
+    return nullptr;
+  }
+  length = (size_t)end;
   is.seekg(0, ios::beg);
-  buffer = new char [length + 1];
+  buffer = (char *)allocBlock(length + 1);
+  if (buffer == nullptr) /* too large, stream it */
+    return nullptr;
   is.read(buffer, length);
-  is.close();
   buffer[length] = nullterminate;
   return buffer;
 }
 
 /*
- * scans a char* buffer for lines that does not
- * start with the specified comment character.
+ * maps the option file read only, values parsed from it
+ * are kept as views into the mapping till they are read
  */
-bool AnyOption::consumeFile(char *buffer) {
-
-  if (buffer == nullptr)
+bool AnyOption::mapFile(const char *fname, AnyOptionResult &result) const {
+#if defined(ANYOPTION_MMAP)
+  struct stat st; /* opening a fifo would take its writer's data */
+  if (stat(fname, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    return false; /* let readFile() deal with it */
+  int fd = open(fname, O_RDONLY | O_NONBLOCK);
+  if (fd < 0)
+    return false;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd); /* let readFile() deal with it */
     return false;
-
-  char *cursor = buffer; /* preserve the ptr */
-  char *pline = nullptr;
-  int linelength = 0;
-  bool newline = true;
-  for (unsigned int i = 0; i < strlen(buffer); i++) {
-    if (*cursor == endofline) { /* end of line */
-      if (pline != nullptr)     /* valid line */
-        processLine(pline, linelength);
-      pline = nullptr;
-      newline = true;
-    } else if (newline) { /* start of line */
-      newline = false;
-      if ((*cursor != comment)) { /* not a comment */
-        pline = cursor;
-        linelength = 0;
-      }
-    }
-    cursor++; /* keep moving */
-    linelength++;
   }
-  delete[] buffer;
-  buffer = nullptr;
+  void *mapping = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return false;
+  madvise(mapping, (size_t)st.st_size, MADV_SEQUENTIAL);
+  result.adoptFile((const char *)mapping, (size_t)st.st_size);
   return true;
+#else
+  (void)fname;
+  (void)result;
+  return false;
+#endif
 }
 
 /*
- *  find a valid type value pair separated by a delimiter
- *  character and pass it to valuePairs()
- *  any line which is not valid will be considered a value
- *  and will get passed on to justValue()
- *
- *  assuming delimiter is ':' the behaviour will be,
- *
- *  width:10    - valid pair valuePairs( width, 10 );
- *  width : 10  - valid pair valuepairs( width, 10 );
+ * binary option file cache, native byte order
  *
- *  ::::        - not valid
- *  width       - not valid
- *  :10         - not valid
- *  width:      - not valid
- *  ::          - not valid
- *  :           - not valid
+ *   CacheHeader
+ *   CacheEntry per value slot
+ *   the values, back to back
  *
+ * the checksum covers everything after the header
+ */
+static const char cache_magic[8] = {'A', 'O', 'C', 'A', 'C', 'H', 'E', '1'};
+static const uint64_t CACHE_UNSET = ~(uint64_t)0;
+static const uint64_t CACHE_FLAG = ~(uint64_t)1;
+
+struct CacheHeader {
+  char magic[8];
+  uint64_t fingerprint;  /* schemaFingerprint() */
+  uint64_t source_size;  /* option file size */
+  int64_t source_mtime;  /* option file modification time */
+  int64_t source_mtime_nsec;
+  uint64_t checksum;
+  uint32_t value_count;
+  uint32_t reserved;
+};
+
+struct CacheEntry {
+  uint64_t offset; /* from the start of the cache, or CACHE_UNSET/FLAG */
+  uint64_t length;
+};
+
+static uint64_t fnv64(uint64_t h, const void *data, size_t length) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < length; i++) {
+    h ^= bytes[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+static const uint64_t FNV64_BASIS = 14695981039346656037ull;
+
+/*
+ * size and modification time identifying a version
+ * of a file, false if it is not a regular file
+ */
+struct FileStamp {
+  uint64_t size;
+  int64_t mtime;
+  int64_t mtime_nsec;
+
+  bool operator==(const FileStamp &other) const {
+    return size == other.size && mtime == other.mtime &&
+           mtime_nsec == other.mtime_nsec;
+  }
+};
+
+static bool fileStamp(const char *fname, FileStamp &stamp) {
+  struct stat st;
+  if (stat(fname, &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG)
+    return false;
+  stamp.size = (uint64_t)st.st_size;
+  stamp.mtime = (int64_t)st.st_mtime;
+#if defined(__linux__)
+  stamp.mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+  stamp.mtime_nsec = (int64_t)st.st_mtimespec.tv_nsec;
+#else
+  stamp.mtime_nsec = 0;
+#endif
+  return true;
+}
+
+static bool sourceStamp(const char *fname, CacheHeader &header) {
+  FileStamp stamp;
+  if (!fileStamp(fname, stamp))
+    return false;
+  header.source_size = stamp.size;
+  header.source_mtime = stamp.mtime;
+  header.source_mtime_nsec = stamp.mtime_nsec;
+  return true;
+}
+
+/*
+ * everything that decides which slot a line sets
  */
+unsigned long long AnyOption::schemaFingerprint() const {
+  uint64_t h = FNV64_BASIS;
+  const char syntax[] = {delimiter, comment, endofline, whitespace};
+  h = fnv64(h, syntax, sizeof(syntax));
+  h = fnv64(h, &g_value_counter, sizeof(g_value_counter));
+  for (unsigned int i = 0; i < option_counter; i++) {
+    h = fnv64(h, options[i], strlen(options[i]) + 1);
+    h = fnv64(h, &optiontype[i], sizeof(optiontype[i]));
+    h = fnv64(h, &optionindex[i], sizeof(optionindex[i]));
+  }
+  for (unsigned int i = 0; i < optchar_counter; i++) {
+    h = fnv64(h, &optionchars[i], sizeof(optionchars[i]));
+    h = fnv64(h, &optchartype[i], sizeof(optchartype[i]));
+    h = fnv64(h, &optcharindex[i], sizeof(optcharindex[i]));
+  }
+  return h;
+}
+
+/*
+ * loads the cache if it is current, else parses the option
+ * file into a fresh result and writes the cache from that,
+ * so values set before ( command line ) stay out of it
+ */
+bool AnyOption::parseCached(const char *fname, AnyOptionResult &result) const {
+  string cachename = string(fname) + ".cache";
+  if (loadCache(cachename.c_str(), fname, result))
+    return true;
+
+  CacheHeader stamp;
+  if (!sourceStamp(fname, stamp)) /* a pipe or missing */
+    return readOrMapFile(fname, result);
+  AnyOptionResult fresh;
+  if (!fresh.prepare(this) || !readOrMapFile(fname, fresh))
+    return false;
+  saveCache(cachename.c_str(), fname, fresh);
+  addStats(result.stats, fresh.stats);
+  for (unsigned int i = 0; i < fresh.value_count; i++) {
+    if (fresh.hasValue(i))
+      result.takeValue(fresh, i);
+  }
+  return true;
+}
+
+bool AnyOption::loadCache(const char *cachename, const char *fname,
+                          AnyOptionResult &result) const {
+  CacheHeader stamp;
+  if (!sourceStamp(fname, stamp))
+    return false;
 
-void AnyOption::processLine(char *theline, int length) {
-  char *pline = new char[length + 1];
-  for (int i = 0; i < length; i++)
-    pline[i] = *(theline++);
-  pline[length] = nullterminate;
-  char *cursor = pline; /* preserve the ptr */
-  if (*cursor == delimiter || *(cursor + length - 1) == delimiter) {
-    justValue(pline); /* line with start/end delimiter */
+  AnyOptionResult cache; /* holds the mapping till it is valid */
+  const char *data = nullptr;
+  size_t length = 0;
+  char *buffer = nullptr;
+  if (mapFile(cachename, cache)) {
+    data = cache.mapped_file;
+    length = cache.mapped_length;
   } else {
-    bool found = false;
-    for (int i = 1; i < length - 1 && !found; i++) { /* delimiter */
-      if (*cursor == delimiter) {
-        *(cursor - 1) = nullterminate; /* two strings */
-        found = true;
-        valuePairs(pline, cursor + 1);
-      }
-      cursor++;
-    }
-    cursor++;
-    if (!found) /* not a pair */
-      justValue(pline);
+    ifstream is(cachename, ifstream::in | ifstream::binary);
+    if (!is.good() || (buffer = readFile(is, length)) == nullptr)
+      return false;
+    data = buffer;
+  }
+
+  CacheHeader header;
+  const CacheEntry *entries = (const CacheEntry *)(data + sizeof(header));
+  bool valid = length >= sizeof(header);
+  if (valid) {
+    memcpy(&header, data, sizeof(header));
+    valid = memcmp(header.magic, cache_magic, sizeof(cache_magic)) == 0 &&
+            header.fingerprint == schemaFingerprint() &&
+            header.value_count == g_value_counter &&
+            header.source_size == stamp.source_size &&
+            header.source_mtime == stamp.source_mtime &&
+            header.source_mtime_nsec == stamp.source_mtime_nsec &&
+            length - sizeof(header) >= header.value_count * sizeof(CacheEntry) &&
+            header.checksum == fnv64(FNV64_BASIS, data + sizeof(header),
+                                     length - sizeof(header));
+  }
+  for (uint32_t i = 0; valid && i < header.value_count; i++) {
+    if (entries[i].offset < CACHE_FLAG)
+      valid = entries[i].offset <= length &&
+              entries[i].length <= length - entries[i].offset;
+  }
+  if (!valid) {
+    freeBlock(buffer, length + 1);
+    return false;
   }
-  delete[] pline;
-  pline = nullptr;
+
+  result.stats.file_bytes += length;
+  if (buffer == nullptr) { /* values stay in the mapped cache */
+    result.adoptFile(cache.mapped_file, cache.mapped_length);
+    cache.mapped_file = nullptr;
+    cache.mapped_length = 0;
+  }
+  for (uint32_t i = 0; i < header.value_count; i++) {
+    if (entries[i].offset == CACHE_FLAG)
+      result.storeFlag(i);
+    else if (entries[i].offset != CACHE_UNSET)
+      result.storeFileValue(i, data + entries[i].offset,
+                            (size_t)entries[i].length);
+  }
+  freeBlock(buffer, length + 1);
+  return true;
 }
 
 /*
- * removes trailing and preceding white spaces from a string
+ * written to a temporary file and renamed over the cache,
+ * a cache that can't be written is only reported
  */
-char *AnyOption::chomp(char *str) {
-  while (*str == whitespace)
-    str++;
-  char *end = str + strlen(str) - 1;
-  while (*end == whitespace)
-    end--;
-  *(end + 1) = nullterminate;
-  return str;
-}
-
-void AnyOption::valuePairs(char *type, char *value) {
-  if (strlen(chomp(type)) == 1) { /* this is a char option */
-    for (unsigned int i = 0; i < optchar_counter; i++) {
-      if (optionchars[i] == type[0]) { /* match */
-        if (optchartype[i] == COMMON_OPT || optchartype[i] == FILE_OPT) {
-          setValue(type[0], chomp(value));
-          return;
-        }
-      }
+void AnyOption::saveCache(const char *cachename, const char *fname,
+                          const AnyOptionResult &values) const {
+  CacheHeader header;
+  memset(&header, 0, sizeof(header));
+  if (!sourceStamp(fname, header))
+    return;
+  memcpy(header.magic, cache_magic, sizeof(cache_magic));
+  header.fingerprint = schemaFingerprint();
+  header.value_count = values.value_count;
+
+  vector<CacheEntry> entries(values.value_count);
+  string data;
+  uint64_t offset = sizeof(header) + entries.size() * sizeof(CacheEntry);
+  for (unsigned int i = 0; i < values.value_count; i++) {
+    entries[i].length = 0;
+    if (values.flagbits[i >> 3] & (1 << (i & 7))) {
+      entries[i].offset = CACHE_FLAG;
+    } else if (values.hasValue(i)) {
+      size_t length = 0;
+      const char *value = values.valueAt(i, length);
+      entries[i].offset = offset + data.size();
+      entries[i].length = length;
+      data.append(value, length);
+    } else {
+      entries[i].offset = CACHE_UNSET;
     }
   }
-  /* if no char options matched */
-  for (unsigned int i = 0; i < option_counter; i++) {
-    if (strcmp(options[i], type) == 0) { /* match */
-      if (optiontype[i] == COMMON_OPT || optiontype[i] == FILE_OPT) {
-        setValue(type, chomp(value));
-        return;
-      }
+  header.checksum = fnv64(FNV64_BASIS, entries.data(),
+                          entries.size() * sizeof(CacheEntry));
+  header.checksum = fnv64(header.checksum, data.data(), data.size());
+
+  string temporary = string(cachename) + ".tmp";
+  {
+    ofstream out(temporary.c_str(), ofstream::out | ofstream::binary);
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)entries.data(), entries.size() * sizeof(CacheEntry));
+    out.write(data.data(), data.size());
+    if (!out.good()) {
+      out.close();
+      remove(temporary.c_str());
+      printVerbose("Could not write option file cache : ");
+      printVerbose(cachename);
+      printVerbose();
+      return;
     }
   }
-  printVerbose("Unknown option in resource file : ");
-  printVerbose(type);
-  printVerbose();
+#if defined(_WIN32)
+  remove(cachename); /* rename does not replace there */
+#endif
+  if (rename(temporary.c_str(), cachename) != 0)
+    remove(temporary.c_str());
 }
 
-void AnyOption::justValue(char *type) {
+/*
+ * included option files
+ */
+static const char include_keyword[] = "include";
 
-  if (strlen(chomp(type)) == 1) { /* this is a char option */
-    for (unsigned int i = 0; i < optchar_counter; i++) {
-      if (optionchars[i] == type[0]) { /* match */
-        if (optchartype[i] == COMMON_FLAG || optchartype[i] == FILE_FLAG) {
-          setFlagOn(type[0]);
-          return;
-        }
+/*
+ * an "include <path>" line, the path is not allowed to
+ * start with the delimiter so "include : x" stays an option
+ */
+static bool includeLine(const char *line, size_t length, char whitespace,
+                        char delimiter, const char *&path, size_t &pathlength) {
+  const size_t keyword = sizeof(include_keyword) - 1;
+  if (length <= keyword || memcmp(line, include_keyword, keyword) != 0 ||
+      line[keyword] != whitespace)
+    return false;
+  path = line + keyword;
+  pathlength = length - keyword;
+  while (pathlength > 0 && *path == whitespace) {
+    path++;
+    pathlength--;
+  }
+  while (pathlength > 0 && path[pathlength - 1] == whitespace)
+    pathlength--;
+  return pathlength > 0 && *path != delimiter;
+}
+
+/*
+ * path relative to the directory of the file including it
+ */
+static string includedPath(const char *path, size_t length,
+                           const AnyOptionIncludeFrame *including) {
+  string included(path, length);
+  bool absolute = path[0] == '/' || path[0] == '\\';
+#if defined(_WIN32)
+  absolute = absolute || (length > 1 && path[1] == ':');
+#endif
+  if (!absolute && including != nullptr) {
+    size_t slash = including->path.find_last_of("/\\");
+    if (slash != string::npos)
+      included = including->path.substr(0, slash + 1) + included;
+  }
+  return canonicalPath(included.c_str());
+}
+
+/*
+ * an included file split into option lines, kept for
+ * every file including it while it is unchanged
+ */
+enum { INCLUDE_PAIR, INCLUDE_FLAG, INCLUDE_FILE };
+
+struct IncludeToken {
+  int kind;
+  size_t key; /* into text, or paths for INCLUDE_FILE */
+  size_t key_length;
+  size_t value;
+  size_t value_length;
+};
+
+struct IncludedFile {
+  FileStamp stamp;
+  string text;
+  vector<IncludeToken> tokens;
+  vector<string> paths; /* its own include lines */
+};
+
+static mutex include_lock;
+static map<string, shared_ptr<const IncludedFile> > include_cache;
+
+void AnyOption::clearIncludeCache() {
+  lock_guard<mutex> lock(include_lock);
+  include_cache.clear();
+}
+
+/*
+ * the included file from the cache, read and split into
+ * lines the way consumeFile() does if it changed
+ */
+static shared_ptr<const IncludedFile> loadInclude(const string &path,
+                                                  const char syntax[4]) {
+  FileStamp stamp;
+  if (!fileStamp(path.c_str(), stamp))
+    return nullptr;
+  const string key = path + '\0' + string(syntax, 4); /* delimiter and co */
+  {
+    lock_guard<mutex> lock(include_lock);
+    map<string, shared_ptr<const IncludedFile> >::iterator found =
+        include_cache.find(key);
+    if (found != include_cache.end() && found->second->stamp == stamp)
+      return found->second;
+  }
+
+  ifstream is(path.c_str(), ifstream::in | ifstream::binary);
+  if (!is.good())
+    return nullptr;
+  shared_ptr<IncludedFile> file(new IncludedFile());
+  file->stamp = stamp;
+  file->text.resize((size_t)stamp.size);
+  is.read(&file->text[0], (streamsize)stamp.size);
+  file->text.resize((size_t)is.gcount());
+
+  const char delimiter = syntax[0], comment = syntax[1];
+  const char endofline = syntax[2], whitespace = syntax[3];
+  AnyOptionIncludeFrame frame(path, nullptr);
+  const char *text = file->text.data();
+  const char *cursor = text;
+  const char *end = text + file->text.size();
+  while (cursor < end) {
+    const char *eol = (const char *)memchr(cursor, endofline, end - cursor);
+    if (eol == nullptr)
+      eol = end;
+    size_t length = eol - cursor;
+    const char *included = nullptr;
+    size_t included_length = 0;
+    IncludeToken token = {INCLUDE_FLAG, (size_t)(cursor - text), length, 0, 0};
+    if (length == 0 || *cursor == comment) {
+      cursor = eol + 1;
+      continue;
+    } else if (includeLine(cursor, length, whitespace, delimiter, included,
+                           included_length)) {
+      token.kind = INCLUDE_FILE;
+      token.key = file->paths.size();
+      file->paths.push_back(includedPath(included, included_length, &frame));
+    } else if (*cursor != delimiter && cursor[length - 1] != delimiter) {
+      const char *split = (const char *)memchr(cursor, delimiter, length);
+      if (split != nullptr) {
+        token.kind = INCLUDE_PAIR;
+        token.key_length = split - cursor;
+        token.value = token.key + token.key_length + 1;
+        token.value_length = length - token.key_length - 1;
       }
     }
+    file->tokens.push_back(token);
+    cursor = eol + 1;
   }
-  /* if no char options matched */
-  for (unsigned int i = 0; i < option_counter; i++) {
-    if (strcmp(options[i], type) == 0) { /* match */
-      if (optiontype[i] == COMMON_FLAG || optiontype[i] == FILE_FLAG) {
-        setFlagOn(type);
-        return;
-      }
+
+  lock_guard<mutex> lock(include_lock);
+  include_cache[key] = file;
+  return file;
+}
+
+void AnyOption::includeFile(const char *path, size_t length,
+                            AnyOptionResult &result) const {
+  includePath(includedPath(path, length, result.including), result);
+}
+
+void AnyOption::includePath(const string &path, AnyOptionResult &result) const {
+  for (const AnyOptionIncludeFrame *frame = result.including; frame != nullptr;
+       frame = frame->parent) {
+    if (frame->path == path) {
+      printVerbose("Include cycle in option file : ");
+      printVerbose(path.c_str());
+      printVerbose();
+      return;
     }
   }
-  printVerbose("Unknown option in resource file : ");
-  printVerbose(type);
-  printVerbose();
+  const char syntax[4] = {delimiter, comment, endofline, whitespace};
+  shared_ptr<const IncludedFile> file = loadInclude(path, syntax);
+  if (file == nullptr) {
+    printVerbose("Could not include option file : ");
+    printVerbose(path.c_str());
+    printVerbose();
+    return;
+  }
+
+  AnyOptionIncludeFrame frame(path, result.including);
+  result.including = &frame;
+  const char *text = file->text.data();
+  for (const IncludeToken &token : file->tokens) {
+    result.stats.lines++;
+    if (token.kind == INCLUDE_PAIR)
+      valuePairs(text + token.key, token.key_length, text + token.value,
+                 token.value_length, result);
+    else if (token.kind == INCLUDE_FLAG)
+      justValue(text + token.key, token.key_length, result);
+    else
+      includePath(file->paths[token.key], result);
+  }
+  result.including = frame.parent;
 }
 
 /*
- * usage and help
+ * scans a char* buffer of length bytes for lines that
+ * does not start with the specified comment character.
  */
+bool AnyOption::consumeFile(const char *buffer, size_t length,
+                            AnyOptionResult &result) const {
 
-void AnyOption::printAutoUsage() {
-  if (autousage)
-    printUsage();
+  if (buffer == nullptr)
+    return false;
+
+  unsigned int threads = file_threads;
+  if (threads == 0)
+    threads = max(1u, thread::hardware_concurrency());
+  if (result.file_threads != 0) /* a share of the threads, see processLayers() */
+    threads = min(threads, result.file_threads);
+  threads = (unsigned int)min<size_t>(threads, length / FILE_THREAD_CHUNK);
+  if (threads > 1)
+    return consumeParallel(buffer, length, threads, result);
+  return consumeLines(buffer, length, result);
 }
 
-void AnyOption::printUsage() {
+/*
+ * splits buffer on line boundaries into a part per thread,
+ * each parsed into its own result holding views into the
+ * buffer, then takes the values of the parts in order so
+ * the last line setting an option still wins
+ */
+bool AnyOption::consumeParallel(const char *buffer, size_t length,
+                                unsigned int threads,
+                                AnyOptionResult &result) const {
+  vector<size_t> begin(threads + 1, length);
+  begin[0] = 0;
+  for (unsigned int i = 1; i < threads; i++) {
+    size_t from = max(begin[i - 1], length / threads * i);
+    const char *eol = (const char *)memchr(buffer + from, endofline, length - from);
+    begin[i] = (eol != nullptr) ? (size_t)(eol - buffer) + 1 : length;
+  }
+
+  AnyOptionResult *parts = newParts(threads);
+  if (parts == nullptr)
+    return consumeLines(buffer, length, result);
+  auto parse = [&](unsigned int i) {
+    if (!parts[i].prepare(this))
+      return;
+    parts[i].including = result.including;
+    parts[i].mapped_file = buffer; /* values stay in the buffer */
+    parts[i].mapped_length = length;
+    consumeLines(buffer + begin[i], begin[i + 1] - begin[i], parts[i]);
+  };
+  vector<thread> workers;
+  for (unsigned int i = 1; i < threads; i++)
+    workers.push_back(thread(parse, i));
+  parse(0); /* the first part on this thread */
+  for (thread &worker : workers)
+    worker.join();
 
-  if (once) {
-    once = false;
-    cout << endl;
-    for (unsigned int i = 0; i < usage_lines; i++)
-      cout << usage[i] << endl;
-    cout << endl;
+  resolveParts(parts, threads, result);
+  for (unsigned int i = 0; i < threads; i++) {
+    parts[i].mapped_file = nullptr; /* not ours to unmap */
+    parts[i].mapped_length = 0;
   }
+  deleteParts(parts, threads);
+  return true;
 }
 
-void AnyOption::addUsage(const char *line) {
-  if (usage_lines >= max_usage_lines) {
-    if (doubleUsageStorage() == false) {
-      addUsageError(line);
-      exit(1);
+/*
+ * results for parsing parts of the input separately,
+ * nullptr if they can't be allocated
+ */
+AnyOptionResult *AnyOption::newParts(unsigned int count) const {
+  AnyOptionResult *parts =
+      (AnyOptionResult *)allocBlock(count * sizeof(AnyOptionResult));
+  for (unsigned int i = 0; parts != nullptr && i < count; i++)
+    new (parts + i) AnyOptionResult(allocator);
+  return parts;
+}
+
+void AnyOption::deleteParts(AnyOptionResult *parts, unsigned int count) const {
+  for (unsigned int i = 0; i < count; i++)
+    parts[i].~AnyOptionResult();
+  freeBlock(parts, count * sizeof(AnyOptionResult));
+}
+
+/*
+ * takes each slot from the last part that set it,
+ * writing it to result once
+ */
+void AnyOption::resolveParts(AnyOptionResult *parts, unsigned int count,
+                             AnyOptionResult &result) const {
+  for (unsigned int i = 0; i < count; i++)
+    addStats(result.stats, parts[i].stats);
+  for (unsigned int j = 0; j < result.value_count; j++) {
+    for (unsigned int i = count; i-- > 0;) {
+      if (parts[i].values != nullptr && parts[i].hasValue(j)) {
+        result.takeValue(parts[i], j);
+        break;
+      }
     }
   }
-  usage[usage_lines] = line;
-  usage_lines++;
 }
 
-void AnyOption::addUsageError(const char *line) {
-  cout << endl;
-  cout << "OPTIONS ERROR : Failed allocating extra memory " << endl;
-  cout << "While adding the usage/help  : \"" << line << "\"" << endl;
-  cout << "Exiting." << endl;
-  cout << endl;
-  exit(0);
+bool AnyOption::consumeLines(const char *buffer, size_t length,
+                             AnyOptionResult &result) const {
+  size_t done = 0; /* lines handled by the vector scanner */
+  FileScanner scan = fileScanner();
+  if (scan != nullptr) {
+    FileToken tokens[FILE_SCAN_TOKENS];
+    size_t count = FILE_SCAN_TOKENS;
+    while (count == FILE_SCAN_TOKENS) {
+      size_t consumed = scan(buffer + done, length - done, endofline, delimiter,
+                             tokens, count);
+      for (size_t i = 0; i < count; i++) {
+        const char *line = buffer + done + tokens[i].offset;
+        if (tokens[i].length > 0 && *line != comment)
+          processLine(line, tokens[i].length, tokens[i].delimiter, result);
+      }
+      done += consumed;
+    }
+  }
+
+  const char *cursor = buffer + done; /* preserve the ptr */
+  const char *end = buffer + length;
+  while (cursor < end) {
+    const char *eol = (const char *)memchr(cursor, endofline, end - cursor);
+    if (eol == nullptr) /* last line without an end of line */
+      eol = end;
+    if (eol > cursor && *cursor != comment) /* valid line, not a comment */
+      processLine(cursor, eol - cursor, result);
+    cursor = eol + 1; /* keep moving */
+  }
+  return true;
+}
+
+static inline unsigned int lowestBit(unsigned int bits) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, bits);
+  return (unsigned int)index;
+#else
+  return (unsigned int)__builtin_ctz(bits);
+#endif
+}
+
+/*
+ * walks the end of line bits of the block at offset at,
+ * taking the first delimiter bit below each as the line's
+ * delimiter, returns false once tokens is full
+ */
+inline bool AnyOption::scanBits(size_t at, unsigned int eols, unsigned int delims,
+                         size_t &start, size_t &delimiter, FileToken *tokens,
+                         size_t &count) {
+  while (eols != 0) {
+    unsigned int eol = eols & (0u - eols);
+    unsigned int before = delims & (eol - 1);
+    if (delimiter == NO_DELIMITER && before != 0)
+      delimiter = at + lowestBit(before) - start;
+    size_t pos = at + lowestBit(eols);
+    FileToken token = {start, pos - start, delimiter};
+    tokens[count++] = token;
+    start = pos + 1;
+    delimiter = NO_DELIMITER;
+    if (count == FILE_SCAN_TOKENS)
+      return false;
+    delims &= ~(eol | (eol - 1)); /* drop this line's delimiters */
+    eols &= eols - 1;
+  }
+  if (delimiter == NO_DELIMITER && delims != 0) /* line goes on */
+    delimiter = at + lowestBit(delims) - start;
+  return true;
+}
+
+/*
+ * scalar scan of the bytes left after the last block
+ */
+size_t AnyOption::scanTail(const char *buffer, size_t at, size_t length,
+                           char eol, char delim, size_t start,
+                           size_t delimiter, FileToken *tokens, size_t &count) {
+  for (; at < length; at++) {
+    if (buffer[at] == eol) {
+      FileToken token = {start, at - start, delimiter};
+      tokens[count++] = token;
+      start = at + 1;
+      delimiter = NO_DELIMITER;
+      if (count == FILE_SCAN_TOKENS)
+        break;
+    } else if (buffer[at] == delim && delimiter == NO_DELIMITER) {
+      delimiter = at - start;
+    }
+  }
+  return start;
+}
+
+/*
+ * file scanners, split buffer into up to FILE_SCAN_TOKENS
+ * lines with their first delimiter, comparing 16 or 32
+ * bytes at a time, and return the bytes of the lines found,
+ * a last line without an end of line is left to the caller
+ */
+size_t AnyOption::scanSSE2(const char *buffer, size_t length, char eol,
+                           char delim, FileToken *tokens, size_t &count) {
+  size_t start = 0;
+  size_t delimiter = NO_DELIMITER;
+  size_t at = 0;
+  count = 0;
+#if defined(ANYOPTION_SSE2)
+  const __m128i eols = _mm_set1_epi8(eol);
+  const __m128i delims = _mm_set1_epi8(delim);
+  for (; at + 16 <= length; at += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(buffer + at));
+    unsigned int eolbits = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(block, eols));
+    unsigned int delimbits =
+        (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(block, delims));
+    if ((eolbits | delimbits) == 0) /* inside a line */
+      continue;
+    if (!scanBits(at, eolbits, delimbits, start, delimiter, tokens, count))
+      return start;
+  }
+#endif
+  return scanTail(buffer, at, length, eol, delim, start, delimiter, tokens,
+                  count);
+}
+
+#if defined(ANYOPTION_AVX2)
+__attribute__((target("avx2")))
+#endif
+size_t AnyOption::scanAVX2(const char *buffer, size_t length, char eol,
+                           char delim, FileToken *tokens, size_t &count) {
+  size_t start = 0;
+  size_t delimiter = NO_DELIMITER;
+  size_t at = 0;
+  count = 0;
+#if defined(ANYOPTION_AVX2)
+  const __m256i eols = _mm256_set1_epi8(eol);
+  const __m256i delims = _mm256_set1_epi8(delim);
+  for (; at + 32 <= length; at += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(buffer + at));
+    unsigned int eolbits =
+        (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, eols));
+    unsigned int delimbits =
+        (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, delims));
+    if ((eolbits | delimbits) == 0) /* inside a line */
+      continue;
+    if (!scanBits(at, eolbits, delimbits, start, delimiter, tokens, count))
+      return start;
+  }
+#endif
+  return scanTail(buffer, at, length, eol, delim, start, delimiter, tokens,
+                  count);
+}
+
+/*
+ * reads chunks from source and passes the complete lines
+ * in them to consumeFile(), a line running past the end
+ * of a chunk is moved to the front and completed by the
+ * next one, the buffer only grows for a line longer than it
+ */
+bool AnyOption::consumeStream(size_t (*readChunk)(void *, char *, size_t),
+                              void *source, AnyOptionResult &result) const {
+  size_t size = DEFAULT_STREAM_CHUNK;
+  char *buffer = (char *)allocBlock(size);
+  if (buffer == nullptr)
+    return false;
+  result.stats.allocations++;
+  result.stats.allocated_bytes += size;
+  size_t kept = 0; /* start of a line from the last chunk */
+  for (;;) {
+    size_t got = readChunk(source, buffer + kept, size - kept);
+    if (got == 0)
+      break;
+    result.stats.file_bytes += got;
+    size_t filled = kept + got;
+    size_t lines = filled;
+    while (lines > 0 && buffer[lines - 1] != endofline)
+      lines--;
+    if (lines == 0) { /* no end of line yet */
+      kept = filled;
+      if (kept == size) {
+        char *larger = (char *)growBlock(buffer, size, 2 * size);
+        if (larger == nullptr) {
+          freeBlock(buffer, size);
+          return false;
+        }
+        result.stats.allocations++;
+        result.stats.allocated_bytes += 2 * size;
+        buffer = larger;
+        size = 2 * size;
+      }
+      continue;
+    }
+    consumeFile(buffer, lines, result);
+    kept = filled - lines;
+    memmove(buffer, buffer + lines, kept);
+  }
+  if (kept > 0) /* last line without an end of line */
+    consumeFile(buffer, kept, result);
+  freeBlock(buffer, size);
+  return true;
+}
+
+size_t AnyOption::readStream(void *source, char *buffer, size_t length) {
+  istream *in = (istream *)source;
+  in->read(buffer, length);
+  return (size_t)in->gcount();
+}
+
+size_t AnyOption::readDescriptor(void *source, char *buffer, size_t length) {
+  int fd = *(int *)source;
+  for (;;) {
+#if defined(_WIN32)
+    int got = _read(fd, buffer, (unsigned int)length);
+#else
+    ssize_t got = read(fd, buffer, length);
+#endif
+    if (got >= 0)
+      return (size_t)got;
+    if (errno != EINTR)
+      return 0;
+  }
+}
+
+/*
+ *  find a valid type value pair separated by a delimiter
+ *  character and pass it to valuePairs()
+ *  any line which is not valid will be considered a value
+ *  and will get passed on to justValue()
+ *
+ *  assuming delimiter is ':' the behaviour will be,
+ *
+ *  width:10    - valid pair valuePairs( width, 10 );
+ *  width : 10  - valid pair valuepairs( width, 10 );
+ *
+ *  ::::        - not valid
+ *  width       - not valid
+ *  :10         - not valid
+ *  width:      - not valid
+ *  ::          - not valid
+ *  :           - not valid
+ *
+ *  the line is not null terminated and is never modified,
+ *  returns the value index set by the line or -1
+ */
+
+int AnyOption::processLine(const char *theline, size_t length,
+                           AnyOptionResult &result) const {
+  const char *cursor = (const char *)memchr(theline, delimiter, length);
+  return processLine(theline, length,
+                     cursor != nullptr ? (size_t)(cursor - theline) : NO_DELIMITER,
+                     result);
+}
+
+/*
+ * with the first delimiter already found by a file scanner
+ */
+int AnyOption::processLine(const char *theline, size_t length,
+                           size_t delimiter_at, AnyOptionResult &result) const {
+  result.stats.lines++;
+  const char *path = nullptr;
+  size_t pathlength = 0;
+  if (file_includes &&
+      includeLine(theline, length, whitespace, delimiter, path, pathlength)) {
+    includeFile(path, pathlength, result);
+    return -1;
+  }
+  if (*theline == delimiter || *(theline + length - 1) == delimiter) {
+    return justValue(theline, length, result); /* line with start/end delimiter */
+  } else {
+    if (delimiter_at != NO_DELIMITER) /* delimiter, two strings */
+      return valuePairs(theline, delimiter_at, theline + delimiter_at + 1,
+                        length - delimiter_at - 1, result);
+    else /* not a pair */
+      return justValue(theline, length, result);
+  }
+}
+
+/*
+ * removes trailing and preceding white spaces from a string
+ */
+void AnyOption::chomp(const char *&str, size_t &length) const {
+  while (length > 0 && *str == whitespace) {
+    str++;
+    length--;
+  }
+  while (length > 0 && str[length - 1] == whitespace)
+    length--;
+}
+
+int AnyOption::valuePairs(const char *type, size_t typelength,
+                          const char *value, size_t valuelength,
+                          AnyOptionResult &result) const {
+  chomp(type, typelength);
+  chomp(value, valuelength);
+  if (typelength == 1) { /* this is a char option */
+    for (int i = findChar(type[0]); i >= 0; i = optcharnext[i]) {
+      if (optchartype[i] == COMMON_OPT || optchartype[i] == FILE_OPT) {
+        result.storeFileValue(optcharindex[i], value, valuelength);
+        return optcharindex[i];
+      }
+    }
+  }
+  /* if no char options matched */
+  for (int i = findOption(type, typelength); i >= 0; i = optionnext[i]) {
+    if (optiontype[i] == COMMON_OPT || optiontype[i] == FILE_OPT) {
+      result.storeFileValue(optionindex[i], value, valuelength);
+      return optionindex[i];
+    }
+  }
+  printVerbose("Unknown option in resource file : ");
+  printVerbose(type, typelength);
+  printVerbose();
+  return -1;
+}
+
+int AnyOption::justValue(const char *type, size_t length,
+                         AnyOptionResult &result) const {
+
+  chomp(type, length);
+  if (length == 1) { /* this is a char option */
+    for (int i = findChar(type[0]); i >= 0; i = optcharnext[i]) {
+      if (optchartype[i] == COMMON_FLAG || optchartype[i] == FILE_FLAG) {
+        result.storeFlag(optcharindex[i]);
+        return optcharindex[i];
+      }
+    }
+  }
+  /* if no char options matched */
+  for (int i = findOption(type, length); i >= 0; i = optionnext[i]) {
+    if (optiontype[i] == COMMON_FLAG || optiontype[i] == FILE_FLAG) {
+      result.storeFlag(optionindex[i]);
+      return optionindex[i];
+    }
+  }
+  printVerbose("Unknown option in resource file : ");
+  printVerbose(type, length);
+  printVerbose();
+  return -1;
+}
+
+/*
+ * usage and help
+ */
+
+void AnyOption::printAutoUsage() { printAutoUsage(parsed); }
+
+void AnyOption::printUsage() { printUsage(parsed); }
+
+void AnyOption::printAutoUsage(AnyOptionResult &result) const {
+  if (autousage)
+    printUsage(result);
+}
+
+void AnyOption::printUsage(AnyOptionResult &result) const {
+
+  if (result.once) {
+    result.once = false;
+    cout << endl;
+    for (unsigned int i = 0; i < usage_lines; i++)
+      cout << usage[i] << endl;
+    cout << endl;
+  }
+}
+
+void AnyOption::addUsage(const char *line) {
+  if (usage_lines >= max_usage_lines) {
+    if (doubleUsageStorage() == false) {
+      addUsageError(line);
+      exit(1);
+    }
+  }
+  usage[usage_lines] = line;
+  usage_lines++;
+}
+
+void AnyOption::addUsageError(const char *line) {
+  cout << endl;
+  cout << "OPTIONS ERROR : Failed allocating extra memory " << endl;
+  cout << "While adding the usage/help  : \"" << line << "\"" << endl;
+  cout << "Exiting." << endl;
+  cout << endl;
+  exit(0);
+}
+
+/*
+ * AnyOptionResult
+ */
+
+AnyOptionResult::AnyOptionResult() {
+  allocator = default_allocator;
+  own_allocator = false;
+  including = nullptr;
+  file_threads = 0;
+  schema = nullptr;
+  value_count = 0;
+  values = nullptr;
+  valueviews = nullptr;
+  valuelengths = nullptr;
+  valueblocks = nullptr;
+  valuerooms = nullptr;
+  flagbits = nullptr;
+  true_value = nullptr;
+  typedvalues = nullptr;
+  arena_chunk = nullptr;
+  arena_used = 0;
+  arena_size = 0;
+  arena_total = 0;
+  mapped_file = nullptr;
+  mapped_length = 0;
+  argv = nullptr;
+  new_argv = nullptr;
+  new_argc = 0;
+  new_argv_size = 0;
+  once = true;
+  hasoptions = false;
+  completion = nullptr;
+  memset(&stats, 0, sizeof(stats));
+}
+
+AnyOptionResult::AnyOptionResult(const AnyOptionAllocator &_allocator)
+    : AnyOptionResult() {
+  allocator = _allocator;
+  own_allocator = true;
+}
+
+AnyOptionResult::~AnyOptionResult() {
+  unmapFile();
+  freeArena(); /* values, flags and new_argv */
+}
+
+void AnyOptionResult::clear() {
+  unmapFile();
+  resetArena();
+  values = nullptr;
+  valueviews = nullptr;
+  valuelengths = nullptr;
+  valueblocks = nullptr;
+  valuerooms = nullptr;
+  flagbits = nullptr;
+  true_value = nullptr;
+  typedvalues = nullptr;
+  argv = nullptr;
+  new_argv = nullptr;
+  new_argc = 0;
+  new_argv_size = 0;
+  once = true;
+  hasoptions = false;
+  completion = nullptr;
+  memset(&stats, 0, sizeof(stats));
+}
+
+/*
+ * allocates the value storage for the options of _schema,
+ * values parsed for another schema are cleared first
+ */
+bool AnyOptionResult::prepare(const AnyOption *_schema) {
+  if (values != nullptr && schema == _schema)
+    return true;
+  if (values != nullptr)
+    clear();
+  schema = _schema;
+  if (!own_allocator && arena_chunk == nullptr)
+    allocator = schema->allocator;
+  value_count = schema->g_value_counter;
+  if (value_count == 0)
+    return false;
+  values = (char **)arenaAlloc(value_count * sizeof(char *));
+  valueviews = (const char **)arenaAlloc(value_count * sizeof(const char *));
+  valuelengths = (size_t *)arenaAlloc(value_count * sizeof(size_t));
+  valueblocks = (char **)arenaAlloc(value_count * sizeof(char *));
+  valuerooms = (size_t *)arenaAlloc(value_count * sizeof(size_t));
+  flagbits = (unsigned char *)arenaAlloc((value_count + 7) / 8);
+  typedvalues = nullptr;
+  for (unsigned int i = 0; i < value_count; i++) {
+    values[i] = nullptr;
+    valueviews[i] = nullptr;
+    valuelengths[i] = 0;
+    valueblocks[i] = nullptr;
+    valuerooms[i] = 0;
+  }
+  memset(flagbits, 0, (value_count + 7) / 8);
+  return true;
+}
+
+char *AnyOptionResult::getValue(const char *option) {
+  if (values == nullptr)
+    return nullptr;
+  int index = schema->valueIndex(option, *this);
+  if (index >= 0)
+    return valueAt(index);
+  return nullptr;
+}
+
+bool AnyOptionResult::getFlag(const char *option) {
+  if (values == nullptr)
+    return false;
+  int index = schema->valueIndex(option, *this);
+  if (index >= 0)
+    return flagAt(index);
+  return false;
+}
+
+char *AnyOptionResult::getValue(char option) {
+  if (values == nullptr)
+    return nullptr;
+  int index = schema->valueIndex(option, *this);
+  if (index >= 0)
+    return valueAt(index);
+  return nullptr;
+}
+
+bool AnyOptionResult::getFlag(char option) {
+  if (values == nullptr)
+    return false;
+  int index = schema->valueIndex(option, *this);
+  if (index >= 0)
+    return flagAt(index);
+  return false;
+}
+
+const char *AnyOptionResult::getValue(const char *option, size_t &length) {
+  if (values == nullptr)
+    return nullptr;
+  int index = schema->valueIndex(option, *this);
+  if (index >= 0)
+    return valueAt(index, length);
+  return nullptr;
+}
+
+const char *AnyOptionResult::getValue(char option, size_t &length) {
+  if (values == nullptr)
+    return nullptr;
+  int index = schema->valueIndex(option, *this);
+  if (index >= 0)
+    return valueAt(index, length);
+  return nullptr;
+}
+
+char *AnyOptionResult::getValue(AnyOptionSlot slot) {
+  if (values == nullptr || slot.index < 0 ||
+      (unsigned int)slot.index >= value_count)
+    return nullptr;
+  return valueAt(slot.index);
+}
+
+bool AnyOptionResult::getFlag(AnyOptionSlot slot) {
+  if (values == nullptr || slot.index < 0 ||
+      (unsigned int)slot.index >= value_count)
+    return false;
+  return flagAt(slot.index);
+}
+
+ValueStatus AnyOptionResult::getInt(const char *option, long long &value) {
+  return getInt(AnyOptionSlot(slotOf(option)), value);
+}
+
+ValueStatus AnyOptionResult::getInt(char option, long long &value) {
+  return getInt(AnyOptionSlot(slotOf(option)), value);
+}
+
+ValueStatus AnyOptionResult::getInt(AnyOptionSlot slot, long long &value) {
+  const TypedValue &typed = typedValue(slot.index, TYPED_INT);
+  if (typed.status == VALUE_OK)
+    value = typed.integer;
+  return (ValueStatus)typed.status;
+}
+
+ValueStatus AnyOptionResult::getDouble(const char *option, double &value) {
+  return getDouble(AnyOptionSlot(slotOf(option)), value);
+}
+
+ValueStatus AnyOptionResult::getDouble(char option, double &value) {
+  return getDouble(AnyOptionSlot(slotOf(option)), value);
+}
+
+ValueStatus AnyOptionResult::getDouble(AnyOptionSlot slot, double &value) {
+  const TypedValue &typed = typedValue(slot.index, TYPED_DOUBLE);
+  if (typed.status == VALUE_OK)
+    value = typed.real;
+  return (ValueStatus)typed.status;
+}
+
+ValueStatus AnyOptionResult::getBool(const char *option, bool &value) {
+  return getBool(AnyOptionSlot(slotOf(option)), value);
+}
+
+ValueStatus AnyOptionResult::getBool(char option, bool &value) {
+  return getBool(AnyOptionSlot(slotOf(option)), value);
+}
+
+ValueStatus AnyOptionResult::getBool(AnyOptionSlot slot, bool &value) {
+  const TypedValue &typed = typedValue(slot.index, TYPED_BOOL);
+  if (typed.status == VALUE_OK)
+    value = typed.boolean;
+  return (ValueStatus)typed.status;
+}
+
+ValueStatus AnyOptionResult::getSize(const char *option, unsigned long long &value) {
+  return getSize(AnyOptionSlot(slotOf(option)), value);
+}
+
+ValueStatus AnyOptionResult::getSize(char option, unsigned long long &value) {
+  return getSize(AnyOptionSlot(slotOf(option)), value);
+}
+
+ValueStatus AnyOptionResult::getSize(AnyOptionSlot slot, unsigned long long &value) {
+  const TypedValue &typed = typedValue(slot.index, TYPED_SIZE);
+  if (typed.status == VALUE_OK)
+    value = typed.size;
+  return (ValueStatus)typed.status;
+}
+
+ValueStatus AnyOptionResult::getDuration(const char *option, long long &value) {
+  return getDuration(AnyOptionSlot(slotOf(option)), value);
+}
+
+ValueStatus AnyOptionResult::getDuration(char option, long long &value) {
+  return getDuration(AnyOptionSlot(slotOf(option)), value);
+}
+
+ValueStatus AnyOptionResult::getDuration(AnyOptionSlot slot, long long &value) {
+  const TypedValue &typed = typedValue(slot.index, TYPED_DURATION);
+  if (typed.status == VALUE_OK)
+    value = typed.integer;
+  return (ValueStatus)typed.status;
+}
+
+int AnyOptionResult::slotOf(const char *option) const {
+  if (values == nullptr)
+    return -1;
+  return schema->valueIndex(option, *this);
+}
+
+int AnyOptionResult::slotOf(char option) const {
+  if (values == nullptr)
+    return -1;
+  return schema->valueIndex(option, *this);
+}
+
+/*
+ * converts the value at index to kind, or returns the
+ * conversion kept from an earlier call, store*() forget it
+ */
+const AnyOptionResult::TypedValue &AnyOptionResult::typedValue(int index,
+                                                               TypedKind kind) {
+  static const TypedValue not_set = {TYPED_NONE, VALUE_NOT_SET, {0}};
+  if (values == nullptr || index < 0 || (unsigned int)index >= value_count)
+    return not_set;
+  if (typedvalues == nullptr) {
+    typedvalues = (TypedValue *)arenaAlloc(value_count * sizeof(TypedValue));
+    memset(typedvalues, 0, value_count * sizeof(TypedValue));
+  }
+  TypedValue &typed = typedvalues[index];
+  if (typed.kind == kind)
+    return typed;
+
+  const char *str = hasValue(index) ? valueAt(index) : nullptr;
+  typed.kind = kind;
+  if (str == nullptr) {
+    typed.status = VALUE_NOT_SET;
+    return typed;
+  }
+  switch (kind) {
+  case TYPED_INT:
+    typed.status = parseInt(str, typed.integer);
+    break;
+  case TYPED_DOUBLE:
+    typed.status = parseDouble(str, typed.real);
+    break;
+  case TYPED_BOOL:
+    typed.status = parseBool(str, typed.boolean);
+    break;
+  case TYPED_SIZE:
+    typed.status = parseSize(str, typed.size);
+    break;
+  case TYPED_DURATION:
+    typed.status = parseDuration(str, typed.integer);
+    break;
+  default:
+    typed.status = VALUE_INVALID;
+  }
+  return typed;
+}
+
+ValueStatus AnyOptionResult::parseInt(const char *str, long long &value) {
+  char *end = nullptr;
+  errno = 0;
+  long long parsed = strtoll(str, &end, 10);
+  if (end == str || *end != '\0' || errno == ERANGE)
+    return VALUE_INVALID;
+  value = parsed;
+  return VALUE_OK;
+}
+
+ValueStatus AnyOptionResult::parseDouble(const char *str, double &value) {
+  char *end = nullptr;
+  errno = 0;
+  double parsed = strtod(str, &end);
+  if (end == str || *end != '\0' || errno == ERANGE)
+    return VALUE_INVALID;
+  value = parsed;
+  return VALUE_OK;
+}
+
+static bool equalsNoCase(const char *str, const char *lower) {
+  for (; *str != '\0' && *lower != '\0'; str++, lower++) {
+    if (tolower((unsigned char)*str) != *lower)
+      return false;
+  }
+  return *str == *lower;
+}
+
+ValueStatus AnyOptionResult::parseBool(const char *str, bool &value) {
+  static const char *const truths[] = {TRUE_FLAG, "yes", "on", "1"};
+  static const char *const falsehoods[] = {"false", "no", "off", "0"};
+  for (unsigned int i = 0; i < 4; i++) {
+    if (equalsNoCase(str, truths[i])) {
+      value = true;
+      return VALUE_OK;
+    }
+    if (equalsNoCase(str, falsehoods[i])) {
+      value = false;
+      return VALUE_OK;
+    }
+  }
+  return VALUE_INVALID;
+}
+
+/*
+ * 512, 64K, 16M, 2G
+ */
+ValueStatus AnyOptionResult::parseSize(const char *str,
+                                       unsigned long long &value) {
+  if (*str < '0' || *str > '9') /* strtoull() takes a sign */
+    return VALUE_INVALID;
+  char *end = nullptr;
+  errno = 0;
+  unsigned long long parsed = strtoull(str, &end, 10);
+  if (errno == ERANGE)
+    return VALUE_INVALID;
+  unsigned int shift = 0;
+  switch (*end) {
+  case 'K':
+  case 'k':
+    shift = 10;
+    end++;
+    break;
+  case 'M':
+  case 'm':
+    shift = 20;
+    end++;
+    break;
+  case 'G':
+  case 'g':
+    shift = 30;
+    end++;
+    break;
+  }
+  if (*end != '\0' || parsed > (ULLONG_MAX >> shift))
+    return VALUE_INVALID;
+  value = parsed << shift;
+  return VALUE_OK;
+}
+
+/*
+ * 250, 250ms, 30s, 5m
+ */
+ValueStatus AnyOptionResult::parseDuration(const char *str, long long &value) {
+  if (*str < '0' || *str > '9')
+    return VALUE_INVALID;
+  char *end = nullptr;
+  errno = 0;
+  long long parsed = strtoll(str, &end, 10);
+  if (errno == ERANGE)
+    return VALUE_INVALID;
+  long long scale = 0;
+  if (*end == '\0' || strcmp(end, "ms") == 0)
+    scale = 1;
+  else if (strcmp(end, "s") == 0)
+    scale = 1000;
+  else if (strcmp(end, "m") == 0)
+    scale = 60 * 1000;
+  if (scale == 0 || parsed > LLONG_MAX / scale)
+    return VALUE_INVALID;
+  value = parsed * scale;
+  return VALUE_OK;
+}
+
+int AnyOptionResult::getArgc() const { return new_argc; }
+
+char *AnyOptionResult::getArgv(unsigned int index) const {
+  if (index < new_argc) {
+    return new_argv[index];
+  }
+  return nullptr;
+}
+
+bool AnyOptionResult::hasOptions() const { return hasoptions; }
+
+const char *AnyOptionResult::getCompletion() const { return completion; }
+
+const AnyOptionStats &AnyOptionResult::getStats() const { return stats; }
+
+bool AnyOptionResult::hasValue(int index) const {
+  return values[index] != nullptr || valueviews[index] != nullptr;
+}
+
+/*
+ * flags are kept in flagbits, option values
+ * set to TRUE_FLAG also count as a set flag
+ */
+bool AnyOptionResult::flagAt(int index) const {
+  if (flagbits[index >> 3] & (1 << (index & 7)))
+    return true;
+
+  size_t length = 0;
+  const char *val = valueAt(index, length);
+  if (val == nullptr)
+    return false;
+
+  if (length == strlen(TRUE_FLAG) && memcmp(TRUE_FLAG, val, length) == 0)
+    return true;
+
+  return false;
+}
+
+/*
+ * returns the value at index as a C string, copying
+ * it out of the mapped option file on first use
+ */
+char *AnyOptionResult::valueAt(int index) {
+  if (valueviews[index] != nullptr) {
+    const char *view = valueviews[index];
+    storeValue(index, view, valuelengths[index]);
+  }
+  return values[index];
+}
+
+/*
+ * returns the value at index without copying it,
+ * the value is not null terminated if it is still
+ * a view into the mapped option file
+ */
+const char *AnyOptionResult::valueAt(int index, size_t &length) const {
+  length = valuelengths[index];
+  if (valueviews[index] != nullptr)
+    return valueviews[index];
+  return values[index];
+}
+
+/*
+ * overwriting a value reuses its storage when the new one
+ * fits, so parsing the same options again doesn't grow
+ */
+void AnyOptionResult::storeValue(int index, const char *value, size_t length) {
+  if (length + 1 > valuerooms[index])
+    allocValues(index, (length + 1) * sizeof(char));
+  values[index] = valueblocks[index];
+  memmove(values[index], value, length);
+  values[index][length] = '\0';
+  valueviews[index] = nullptr;
+  valuelengths[index] = length;
+  flagbits[index >> 3] &= ~(1 << (index & 7));
+  if (typedvalues != nullptr)
+    typedvalues[index].kind = TYPED_NONE;
+}
+
+/*
+ * all flags share one TRUE_FLAG value string
+ */
+void AnyOptionResult::storeFlag(int index) {
+  if (true_value == nullptr) {
+    true_value = (char *)arenaAlloc(strlen(TRUE_FLAG) + 1);
+    strcpy(true_value, TRUE_FLAG);
+  }
+  values[index] = true_value;
+  valueviews[index] = nullptr;
+  valuelengths[index] = strlen(TRUE_FLAG);
+  flagbits[index >> 3] |= (1 << (index & 7));
+  if (typedvalues != nullptr)
+    typedvalues[index].kind = TYPED_NONE;
+}
+
+/*
+ * keeps a reference to the value inside the mapped
+ * option file, valueAt() makes the copy when needed
+ */
+void AnyOptionResult::storeValueView(int index, const char *value, size_t length) {
+  values[index] = nullptr;
+  valueviews[index] = value;
+  valuelengths[index] = length;
+  flagbits[index >> 3] &= ~(1 << (index & 7));
+  if (typedvalues != nullptr)
+    typedvalues[index].kind = TYPED_NONE;
+}
+
+
+void AnyOptionResult::storeBorrowedValue(int index, char *value) {
+  values[index] = value;
+  valueviews[index] = nullptr;
+  valuelengths[index] = strlen(value);
+  flagbits[index >> 3] &= ~(1 << (index & 7));
+  if (typedvalues != nullptr)
+    typedvalues[index].kind = TYPED_NONE;
+}
+
+/*
+ * values from a mapped option file stay in the mapping
+ */
+void AnyOptionResult::storeFileValue(int index, const char *value,
+                                     size_t length) {
+  if (mapped_file != nullptr && value >= mapped_file &&
+      value < mapped_file + mapped_length)
+    storeValueView(index, value, length);
+  else
+    storeValue(index, value, length);
+}
+
+void AnyOptionResult::forgetValue(int index) {
+  values[index] = nullptr;
+  valueviews[index] = nullptr;
+  valuelengths[index] = 0;
+  flagbits[index >> 3] &= ~(1 << (index & 7));
+  if (typedvalues != nullptr)
+    typedvalues[index].kind = TYPED_NONE;
+}
+
+/*
+ * copies the value at index from another result
+ * of the same schema
+ */
+void AnyOptionResult::copyValue(const AnyOptionResult &from, int index) {
+  if (from.flagbits[index >> 3] & (1 << (index & 7))) {
+    storeFlag(index);
+  } else if (from.hasValue(index)) {
+    size_t length = 0;
+    const char *value = from.valueAt(index, length);
+    storeValue(index, value, length);
+  }
+}
+
+/*
+ * like copyValue(), but a value still in the other result's
+ * buffer is stored as a file value, copied only if it is not
+ * in the file mapped by this result
+ */
+void AnyOptionResult::takeValue(const AnyOptionResult &from, int index) {
+  if (from.flagbits[index >> 3] & (1 << (index & 7)))
+    storeFlag(index);
+  else if (from.valueviews[index] != nullptr)
+    storeFileValue(index, from.valueviews[index], from.valuelengths[index]);
+  else if (from.values[index] != nullptr)
+    storeValue(index, from.values[index], from.valuelengths[index]);
+}
+
+void AnyOptionResult::allocValues(int index, size_t length) {
+  stats.allocations++;
+  stats.allocated_bytes += length;
+  valueblocks[index] = (char *)arenaAlloc(length);
+  valuerooms[index] = length;
+}
+
+/*
+ * bump allocator backing all the value storage, chunks
+ * grow with the arena and are only freed in cleanup(),
+ * each starts with the previous chunk and its size
+ */
+static const size_t ARENA_HEADER = 2 * sizeof(void *);
+
+void *AnyOptionResult::arenaAlloc(size_t length) {
+  void *block = arenaTryAlloc(length);
+  if (block == nullptr) {
+    cout << endl << "OPTIONS ERROR : Failed allocating memory";
+    cout << endl;
+    cout << "Exiting." << endl;
+    exit(0);
+  }
+  return block;
+}
+
+/*
+ * like arenaAlloc(), but returns nullptr when out of memory
+ */
+void *AnyOptionResult::arenaTryAlloc(size_t length) {
+  if (length > SIZE_MAX - ARENA_HEADER - sizeof(void *))
+    return nullptr;
+  /* keep every allocation pointer aligned */
+  length = (length + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  if (arena_chunk != nullptr && arena_used + length <= arena_size) {
+    void *block = arena_chunk + ARENA_HEADER + arena_used;
+    arena_used += length;
+    return block;
+  }
+  size_t size = DEFAULT_ARENA_CHUNK;
+  if (size < arena_total) /* grow with the arena */
+    size = arena_total;
+  if (size < length)
+    size = length;
+  char *chunk = (char *)allocateFrom(allocator, ARENA_HEADER + size);
+  if (chunk == nullptr)
+    return nullptr;
+  arena_total += size;
+  *(size_t *)(chunk + sizeof(char *)) = size;
+  if (arena_chunk != nullptr && size - length < arena_size - arena_used) {
+    /* the current chunk has more room left, keep it current */
+    *(char **)chunk = *(char **)arena_chunk;
+    *(char **)arena_chunk = chunk;
+    return chunk + ARENA_HEADER;
+  }
+  *(char **)chunk = arena_chunk; /* chain to the previous chunk */
+  arena_chunk = chunk;
+  arena_size = size;
+  arena_used = length;
+  return chunk + ARENA_HEADER;
+}
+
+void AnyOptionResult::freeChunk(char *chunk) {
+  size_t size = *(size_t *)(chunk + sizeof(char *));
+  deallocateTo(allocator, chunk, ARENA_HEADER + size);
+}
+
+void AnyOptionResult::freeArena() {
+  while (arena_chunk != nullptr) {
+    char *previous = *(char **)arena_chunk;
+    freeChunk(arena_chunk);
+    arena_chunk = previous;
+  }
+  arena_used = 0;
+  arena_size = 0;
+  arena_total = 0;
+}
+
+/*
+ * moves the values and arguments to an arena from _allocator,
+ * for a result taking the allocator of the options it parses
+ */
+void AnyOptionResult::rebase(const AnyOptionAllocator &_allocator) {
+  if (own_allocator)
+    return;
+  if (arena_chunk != nullptr) {
+    AnyOptionResult moved(_allocator);
+    moved.copyFrom(*this);
+    clear();
+    freeArena(); /* with the old allocator */
+    allocator = _allocator;
+    copyFrom(moved);
+  }
+  allocator = _allocator;
+}
+
+/*
+ * copies the values, flags and arguments of another result,
+ * arguments in its arena ( response files ) included
+ */
+void AnyOptionResult::copyFrom(const AnyOptionResult &from) {
+  if (from.schema == nullptr || from.values == nullptr || !prepare(from.schema))
+    return;
+  for (unsigned int i = 0; i < from.value_count; i++)
+    copyValue(from, (int)i);
+  argv = from.argv;
+  new_argc = from.new_argc;
+  new_argv_size = from.new_argc;
+  if (new_argc > 0) {
+    new_argv = (char **)arenaAlloc(new_argc * sizeof(char *));
+    for (unsigned int i = 0; i < new_argc; i++) {
+      char *arg = from.new_argv[i];
+      if (from.inArena(arg)) {
+        new_argv[i] = (char *)arenaAlloc(strlen(arg) + 1);
+        strcpy(new_argv[i], arg);
+      } else {
+        new_argv[i] = arg;
+      }
+    }
+  }
+  if (from.inArena(from.completion)) {
+    char *prefix = (char *)arenaAlloc(strlen(from.completion) + 1);
+    strcpy(prefix, from.completion);
+    completion = prefix;
+  } else {
+    completion = from.completion;
+  }
+  once = from.once;
+  hasoptions = from.hasoptions;
+  stats = from.stats;
+}
+
+bool AnyOptionResult::inArena(const char *block) const {
+  for (const char *chunk = arena_chunk; chunk != nullptr;
+       chunk = *(char *const *)chunk) {
+    size_t size = *(const size_t *)(chunk + sizeof(char *));
+    if (block >= chunk + ARENA_HEADER && block < chunk + ARENA_HEADER + size)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * frees all but the current ( largest ) chunk
+ * and starts allocating from it again
+ */
+void AnyOptionResult::resetArena() {
+  if (arena_chunk == nullptr)
+    return;
+  char *previous = *(char **)arena_chunk;
+  while (previous != nullptr) {
+    char *next = *(char **)previous;
+    freeChunk(previous);
+    previous = next;
+  }
+  *(char **)arena_chunk = nullptr;
+  arena_used = 0;
+  arena_total = arena_size;
+}
+
+void AnyOptionResult::adoptFile(const char *mapping, size_t length) {
+  releaseFile();
+  mapped_file = mapping;
+  mapped_length = length;
+}
+
+/*
+ * copies the values still referring to the mapped
+ * option file and unmaps it
+ */
+void AnyOptionResult::releaseFile() {
+  if (mapped_file == nullptr)
+    return;
+  for (unsigned int i = 0; i < value_count; i++)
+    valueAt(i);
+  unmapFile();
+}
+
+void AnyOptionResult::unmapFile() {
+#if defined(ANYOPTION_MMAP)
+  if (mapped_file != nullptr)
+    munmap((void *)mapped_file, mapped_length);
+#endif
+  mapped_file = nullptr;
+  mapped_length = 0;
+}
+
+/*
+ * AnyOptionWatcher
+ */
+
+AnyOptionWatcher::AnyOptionWatcher(const AnyOption &_schema)
+    : schema(_schema) {
+  watch_fd = -1;
+  wakeup[0] = -1;
+  wakeup[1] = -1;
+  text = nullptr;
+  text_length = 0;
+  text_allocator = _schema.allocator;
+}
+
+AnyOptionWatcher::~AnyOptionWatcher() {
+  stop();
+  forgetText();
+}
+
+bool AnyOptionWatcher::start() {
+  if (!schema.FileSet())
+    return false;
+  return start(schema.filename);
+}
+
+bool AnyOptionWatcher::start(const char *_filename) {
+  stop();
+  forgetText();
+  filename = _filename;
+  bool parsed = reload();
+  startWatching();
+  return parsed;
+}
+
+void AnyOptionWatcher::stop() {
+#if defined(ANYOPTION_INOTIFY)
+  if (watching.joinable()) {
+    char wake = 0;
+    ssize_t written = write(wakeup[1], &wake, 1);
+    (void)written; /* the pipe is never full */
+    watching.join();
+  }
+  if (watch_fd >= 0)
+    close(watch_fd);
+  if (wakeup[0] >= 0) {
+    close(wakeup[0]);
+    close(wakeup[1]);
+  }
+#endif
+  watch_fd = -1;
+  wakeup[0] = -1;
+  wakeup[1] = -1;
+}
+
+bool AnyOptionWatcher::reload() {
+  vector<AnyOptionSlot> changed;
+  return reload(changed);
+}
+
+/* bytes a and b start with */
+static size_t commonPrefix(const char *a, const char *b, size_t length) {
+  const size_t block = 4096;
+  size_t same = 0;
+  while (same + block <= length && memcmp(a + same, b + same, block) == 0)
+    same += block;
+  while (same < length && a[same] == b[same])
+    same++;
+  return same;
+}
+
+/* bytes a and b end with */
+static size_t commonSuffix(const char *a_end, const char *b_end, size_t length) {
+  const size_t block = 4096;
+  size_t same = 0;
+  while (same + block <= length &&
+         memcmp(a_end - same - block, b_end - same - block, block) == 0)
+    same += block;
+  while (same < length && a_end[-(ptrdiff_t)same - 1] == b_end[-(ptrdiff_t)same - 1])
+    same++;
+  return same;
+}
+
+bool AnyOptionWatcher::lineBefore(const FileLine &line, size_t offset) {
+  return line.offset < offset;
+}
+
+/*
+ * the new file is compared with the last one from both
+ * ends, only the lines in between are processed, every
+ * other value is carried over from the last values
+ *
+ * a slot set by a changed line gets the value of the last
+ * line setting it, which can be an unchanged line before
+ * or after the changed ones, found through lastline and
+ * prevline without looking at the unchanged text
+ */
+bool AnyOptionWatcher::reload(vector<AnyOptionSlot> &changed) {
+  lock_guard<mutex> lock(reloading);
+  changed.clear();
+  size_t length = 0;
+  char *buffer = schema.readFile(filename.c_str(), length);
+  if (buffer == nullptr)
+    return false;
+  AnyOptionAllocator buffer_allocator = schema.allocator;
+  shared_ptr<AnyOptionResult> fresh(new AnyOptionResult());
+  if (!fresh->prepare(&schema)) {
+    schema.freeBlock(buffer, length + 1);
+    return false;
+  }
+  fresh->hasoptions = true;
+  AnyOptionIncludeFrame frame(canonicalPath(filename.c_str()), nullptr);
+  fresh->including = &frame;
+  shared_ptr<AnyOptionResult> previous = atomic_load(&current);
+  /* included files can change without this one changing */
+  const bool incremental =
+      (text != nullptr && previous != nullptr && !schema.file_includes);
+  const unsigned int slots = fresh->value_count;
+
+  /* the changed lines, whole lines around the changed bytes */
+  size_t common = incremental ? min(length, text_length) : 0;
+  size_t prefix = commonPrefix(text, buffer, common);
+  size_t suffix = incremental ? commonSuffix(text + text_length, buffer + length,
+                                             common - prefix)
+                              : 0;
+  size_t begin = prefix;
+  while (begin > 0 && buffer[begin - 1] != schema.endofline)
+    begin--;
+  size_t old_end = text_length - suffix;
+  while (old_end < text_length && text[old_end] != schema.endofline)
+    old_end++;
+  size_t end = length - (text_length - old_end);
+
+  /* lines [first, last) of the last parse are gone */
+  size_t first = lower_bound(lines.begin(), lines.end(), begin, &lineBefore) -
+                 lines.begin();
+  size_t last = lower_bound(lines.begin(), lines.end(), old_end + 1, &lineBefore) -
+                lines.begin();
+
+  if (incremental) {
+    for (unsigned int i = 0; i < slots; i++)
+      fresh->copyValue(*previous, i);
+  }
+
+  vector<FileLine> found;
+  indexLines(buffer, begin, end, *fresh, found);
+
+  vector<bool> marked(slots, false);
+  vector<int> dirty;
+  if (!incremental) {
+    for (unsigned int i = 0; i < slots; i++)
+      dirty.push_back(i);
+  }
+  for (size_t i = 0; i < found.size(); i++) {
+    int slot = found[i].slot;
+    if (slot >= 0 && !marked[slot]) {
+      marked[slot] = true;
+      if (incremental)
+        dirty.push_back(slot);
+    }
+  }
+  for (size_t i = first; i < last; i++) {
+    int slot = lines[i].slot;
+    if (slot < 0 || marked[slot])
+      continue;
+    /* set by a removed line only, back to an earlier line */
+    marked[slot] = true;
+    dirty.push_back(slot);
+    fresh->forgetValue(slot);
+    int line = lastline[slot];
+    while (line >= (int)first)
+      line = prevline[line];
+    if (line >= 0)
+      schema.processLine(buffer + lines[line].offset, lines[line].length, *fresh);
+  }
+  if (incremental) { /* an unchanged line after the changes wins */
+    for (size_t i = 0; i < dirty.size(); i++) {
+      int line = lastline[dirty[i]];
+      if (line >= (int)last)
+        schema.processLine(buffer + lines[line].offset + length - text_length,
+                           lines[line].length, *fresh);
+    }
+  }
+
+  for (size_t i = 0; i < dirty.size(); i++) {
+    int slot = dirty[i];
+    if (previous == nullptr ? fresh->hasValue(slot)
+                            : !sameValue(*previous, *fresh, slot))
+      changed.push_back(AnyOptionSlot(slot));
+  }
+
+  /* keep the new file for the next reload */
+  for (size_t i = last; i < lines.size(); i++)
+    lines[i].offset = lines[i].offset + length - text_length;
+  lines.erase(lines.begin() + first, lines.begin() + last);
+  lines.insert(lines.begin() + first, found.begin(), found.end());
+  if (text != nullptr)
+    deallocateTo(text_allocator, text, text_length + 1);
+  text = buffer;
+  text_length = length;
+  text_allocator = buffer_allocator;
+  linkLines();
+
+  fresh->including = nullptr;
+  atomic_store(&current, fresh);
+
+  for (size_t i = 0; i < listeners.size(); i++) {
+    for (size_t c = 0; c < changed.size(); c++) {
+      if (changed[c].index == listeners[i].slot.index) {
+        listeners[i].callback(listeners[i].slot, *fresh, listeners[i].data);
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+/*
+ * processes the option lines in buffer[begin, end)
+ * like consumeFile(), noting which slot each one sets
+ */
+void AnyOptionWatcher::indexLines(const char *buffer, size_t begin, size_t end,
+                                  AnyOptionResult &values,
+                                  vector<FileLine> &found) const {
+  const char *cursor = buffer + begin;
+  const char *stop = buffer + end;
+  while (cursor < stop) {
+    const char *eol = (const char *)memchr(cursor, schema.endofline, stop - cursor);
+    if (eol == nullptr)
+      eol = stop;
+    if (eol > cursor && *cursor != schema.comment) {
+      FileLine line = {(size_t)(cursor - buffer), (size_t)(eol - cursor),
+                       schema.processLine(cursor, eol - cursor, values)};
+      found.push_back(line);
+    }
+    cursor = eol + 1;
+  }
+}
+
+void AnyOptionWatcher::linkLines() {
+  lastline.assign(schema.g_value_counter, -1);
+  prevline.resize(lines.size());
+  for (size_t i = 0; i < lines.size(); i++) {
+    int slot = lines[i].slot;
+    prevline[i] = slot >= 0 ? lastline[slot] : -1;
+    if (slot >= 0)
+      lastline[slot] = (int)i;
+  }
+}
+
+void AnyOptionWatcher::forgetText() {
+  if (text != nullptr)
+    deallocateTo(text_allocator, text, text_length + 1);
+  text = nullptr;
+  text_length = 0;
+  lines.clear();
+  lastline.clear();
+  prevline.clear();
+}
+
+shared_ptr<AnyOptionResult> AnyOptionWatcher::snapshot() const {
+  return atomic_load(&current);
+}
+
+void AnyOptionWatcher::onChange(AnyOptionSlot slot, ChangeCallback callback,
+                                void *data) {
+  lock_guard<mutex> lock(reloading);
+  Listener listener = {slot, callback, data};
+  listeners.push_back(listener);
+}
+
+bool AnyOptionWatcher::sameValue(const AnyOptionResult &a,
+                                 const AnyOptionResult &b, int index) {
+  if (index < 0 || (unsigned int)index >= a.value_count ||
+      (unsigned int)index >= b.value_count)
+    return true;
+  if (a.hasValue(index) != b.hasValue(index))
+    return false;
+  if (!a.hasValue(index))
+    return true;
+  size_t alength = 0;
+  size_t blength = 0;
+  const char *avalue = a.valueAt(index, alength);
+  const char *bvalue = b.valueAt(index, blength);
+  return alength == blength && memcmp(avalue, bvalue, alength) == 0;
+}
+
+/*
+ * watches the directory of the option file, so a file
+ * replaced by rename ( like most editors do ) is seen too,
+ * a file is only read once closed, never half written
+ */
+bool AnyOptionWatcher::startWatching() {
+#if defined(ANYOPTION_INOTIFY)
+  size_t slash = filename.rfind('/');
+  string directory = slash == string::npos ? "." : filename.substr(0, slash + 1);
+  watch_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (watch_fd < 0)
+    return false;
+  if (inotify_add_watch(watch_fd, directory.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0 ||
+      pipe(wakeup) != 0) {
+    stop();
+    return false;
+  }
+  watching = thread(&AnyOptionWatcher::watch, this);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void AnyOptionWatcher::watch() {
+#if defined(ANYOPTION_INOTIFY)
+  size_t slash = filename.rfind('/');
+  string name = slash == string::npos ? filename : filename.substr(slash + 1);
+  alignas(struct inotify_event) char buffer[4096];
+  struct pollfd fds[2] = {{watch_fd, POLLIN, 0}, {wakeup[0], POLLIN, 0}};
+  for (;;) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (fds[1].revents != 0) /* stop() */
+      return;
+    bool changed = false;
+    ssize_t length;
+    while ((length = read(watch_fd, buffer, sizeof(buffer))) > 0) {
+      for (char *event = buffer; event < buffer + length;) {
+        const struct inotify_event *info = (const struct inotify_event *)event;
+        if (info->len > 0 && name == info->name)
+          changed = true;
+        event += sizeof(struct inotify_event) + info->len;
+      }
+    }
+    if (changed)
+      reload();
+  }
+#endif
 }
@@ -8,8 +8,12 @@
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <stdlib.h>
 #include <string>
+#include <thread>
+#include <vector>
 
 enum OptionType {
     INVALID_OPT = 0,
@@ -19,6 +23,8 @@ enum OptionType {
     COMMON_FLAG = 4,
     COMMAND_FLAG = 5,
     FILE_FLAG = 6,
+    ENVIRONMENT_OPT = 7,
+    ENVIRONMENT_FLAG = 8,
 };
 
 enum {
@@ -27,12 +33,313 @@ enum {
 
 	DEFAULT_MAXUSAGE=3,
 	DEFAULT_MAXHELP=10,
+
+	OPTION_CHAR_SLOTS=256,
+	DEFAULT_ARENA_CHUNK=4096,
+	DEFAULT_STREAM_CHUNK=65536,
+	FILE_SCAN_TOKENS=256,
+	FILE_THREAD_CHUNK=1048576,
+	RESPONSE_FILE_DEPTH=16,
+};
+
+/*
+ * outcome of the typed getters, getInt() and friends
+ */
+enum ValueStatus {
+    VALUE_OK = 0,
+    VALUE_NOT_SET = 1,
+    VALUE_INVALID = 2, /* not a number of that type, or out of range */
+};
+
+/*
+ * the parse phases reported to a stats callback
+ */
+enum ParsePhase {
+    PARSE_COMMAND = 0, /* processCommandArgs() */
+    PARSE_FILE = 1,    /* processFile() and processStream() */
+    PARSE_ENVIRONMENT = 2, /* processEnvironment() */
+};
+
+/*
+ * what registering and parsing cost, see
+ * AnyOption::setInstrumentation(), times are only taken
+ * while it is on and are in nanoseconds
+ */
+struct AnyOptionStats {
+  unsigned long long allocations;     /* option and value storage */
+  unsigned long long allocated_bytes;
+  unsigned long long file_bytes;      /* option file bytes read */
+  unsigned long long lines;           /* option file lines processed */
+  unsigned long long lookups;         /* command line and environment entries compared */
+  unsigned long long register_ns;     /* adding options */
+  unsigned long long command_ns;      /* parsing command lines */
+  unsigned long long file_ns;         /* parsing option files */
+  unsigned long long environment_ns;  /* reading the environment */
+};
+
+/*
+ * where AnyOption and AnyOptionResult get their memory,
+ * allocate returns memory aligned for any type or nullptr,
+ * deallocate gets the size the block was allocated with,
+ * parsing may run on several threads but the calls are
+ * made one at a time, so neither needs to be thread safe
+ */
+struct AnyOptionAllocator {
+  void *(*allocate)(size_t size, void *data);
+  void (*deallocate)(void *block, size_t size, void *data);
+  void *data;
 };
 
 #define TRUE_FLAG "true"
 
 using namespace std;
 
+class AnyOption;
+
+/*
+ * one entry of an option table declared at compile time,
+ * name or optchar can be left out as nullptr or 0
+ *
+ *   constexpr AnyOptionDecl options[] = {
+ *       {"width", 'w', COMMON_OPT},
+ *       {"verbose", 0, COMMAND_FLAG},
+ *   };
+ *   constexpr AnyOptionSlot width = anyOptionSlot(options, "width");
+ *
+ *   AnyOption opt(options);
+ *   opt.processCommandArgs(argc, argv);
+ *   char *value = opt.getValue(width);
+ */
+struct AnyOptionDecl {
+  const char *name;
+  char optchar;
+  OptionType type;
+};
+
+/*
+ * index into value storage of an option, resolved once,
+ * returned by the AnyOption set methods or anyOptionSlot()
+ */
+struct AnyOptionSlot {
+  int index;
+  constexpr explicit AnyOptionSlot(int _index) : index(_index) {}
+};
+
+constexpr bool anyOptionNameEquals(const char *a, const char *b) {
+  return *a == *b && (*a == '\0' || anyOptionNameEquals(a + 1, b + 1));
+}
+
+/*
+ * slot of an option in a table registered with
+ * AnyOption( table ), an unknown option fails to compile
+ * when the slot is a constexpr
+ */
+template <size_t N>
+constexpr AnyOptionSlot anyOptionSlot(const AnyOptionDecl (&table)[N],
+                                      const char *name, size_t i = 0) {
+  return i == N ? throw "AnyOption: unknown option name"
+         : (table[i].name != nullptr && anyOptionNameEquals(table[i].name, name))
+             ? AnyOptionSlot((int)i)
+             : anyOptionSlot(table, name, i + 1);
+}
+
+template <size_t N>
+constexpr AnyOptionSlot anyOptionSlot(const AnyOptionDecl (&table)[N],
+                                      char optchar, size_t i = 0) {
+  return i == N ? throw "AnyOption: unknown option character"
+         : (optchar != 0 && table[i].optchar == optchar)
+             ? AnyOptionSlot((int)i)
+             : anyOptionSlot(table, optchar, i + 1);
+}
+
+struct AnyOptionIncludeFrame;
+
+/*
+ * values, flags and arguments from one parse, filled by
+ * a const AnyOption which only reads its registered options,
+ * see AnyOption::processCommandArgs( argc, argv, result )
+ *
+ * a result is not shared between threads, even the getters
+ * write to it when copying values out of a mapped option file
+ */
+class AnyOptionResult {
+
+public:
+  AnyOptionResult();
+
+  /*
+   * values from allocator, without one from the allocator
+   * of the options parsed with, see AnyOption::setAllocator()
+   */
+  explicit AnyOptionResult(const AnyOptionAllocator &_allocator);
+  ~AnyOptionResult();
+
+  /*
+   * forget all values before parsing the next input,
+   * keeping the storage for reuse
+   */
+  void clear();
+
+  /*
+   * get the value of the options
+   * will return NULL if no value is set
+   */
+  char *getValue(const char *_option);
+  bool getFlag(const char *_option);
+  char *getValue(char _optchar);
+  bool getFlag(char _optchar);
+  const char *getValue(const char *_option, size_t &length);
+  const char *getValue(char _optchar, size_t &length);
+  char *getValue(AnyOptionSlot slot);
+  bool getFlag(AnyOptionSlot slot);
+
+  /*
+   * get the value converted to a type, the conversion is
+   * done once and kept till the value changes, value is
+   * left untouched unless VALUE_OK is returned
+   *
+   * getBool()     - true/false, yes/no, on/off, 1/0 or a set flag
+   * getSize()     - bytes, with an optional K, M or G suffix ( 1024 based )
+   * getDuration() - milliseconds, with an optional ms, s or m suffix
+   */
+  ValueStatus getInt(const char *_option, long long &value);
+  ValueStatus getInt(char _optchar, long long &value);
+  ValueStatus getInt(AnyOptionSlot slot, long long &value);
+  ValueStatus getDouble(const char *_option, double &value);
+  ValueStatus getDouble(char _optchar, double &value);
+  ValueStatus getDouble(AnyOptionSlot slot, double &value);
+  ValueStatus getBool(const char *_option, bool &value);
+  ValueStatus getBool(char _optchar, bool &value);
+  ValueStatus getBool(AnyOptionSlot slot, bool &value);
+  ValueStatus getSize(const char *_option, unsigned long long &value);
+  ValueStatus getSize(char _optchar, unsigned long long &value);
+  ValueStatus getSize(AnyOptionSlot slot, unsigned long long &value);
+  ValueStatus getDuration(const char *_option, long long &value);
+  ValueStatus getDuration(char _optchar, long long &value);
+  ValueStatus getDuration(AnyOptionSlot slot, long long &value);
+
+  /*
+   * get the argument count and arguments sans the options
+   */
+  int getArgc() const;
+  char *getArgv(unsigned int index) const;
+  bool hasOptions() const;
+
+  /*
+   * the prefix of a completion request on the command line
+   * ( see setCompletionOption() ), or nullptr if none, the
+   * options after it are not parsed
+   */
+  const char *getCompletion() const;
+
+  /*
+   * counts kept while parsing into this result
+   */
+  const AnyOptionStats &getStats() const;
+
+private:
+  friend class AnyOption;
+  friend class AnyOptionWatcher;
+
+  AnyOptionResult(const AnyOptionResult &);            /* not copyable */
+  AnyOptionResult &operator=(const AnyOptionResult &); /* not copyable */
+
+  const AnyOption *schema;  /* the options these values belong to */
+  unsigned int value_count; /* number of values */
+
+  /* values */
+  char **values;           /* common value storage */
+  const char **valueviews; /* values still in the mapped option file */
+  size_t *valuelengths;    /* value lengths */
+  char **valueblocks;      /* arena storage owned by each value, reused */
+  size_t *valuerooms;      /* bytes in valueblocks */
+  unsigned char *flagbits; /* flags set, one bit per value */
+  char *true_value;        /* TRUE_FLAG shared by all set flags */
+
+  /* values converted by the typed getters */
+  enum TypedKind {
+    TYPED_NONE = 0,
+    TYPED_INT,
+    TYPED_DOUBLE,
+    TYPED_BOOL,
+    TYPED_SIZE,
+    TYPED_DURATION,
+  };
+  struct TypedValue {
+    unsigned char kind;   /* TypedKind converted to, TYPED_NONE if stale */
+    unsigned char status; /* ValueStatus of the conversion */
+    union {
+      long long integer; /* TYPED_INT, TYPED_DURATION */
+      unsigned long long size;
+      double real;
+      bool boolean;
+    };
+  };
+  TypedValue *typedvalues; /* allocated by the first typed getter */
+
+  /* value storage arena, a chain of chunks */
+  char *arena_chunk;  /* current chunk, starts with the previous chunk ptr */
+  size_t arena_used;  /* bytes used in the current chunk */
+  size_t arena_size;  /* bytes available in the current chunk */
+  size_t arena_total; /* bytes in all chunks */
+
+  const char *mapped_file; /* the mapped option file */
+  size_t mapped_length;    /* length of the mapped option file */
+
+  char **argv;           /* commnd line args */
+  char **new_argv;       /* arguments sans options, in argv or a response file */
+  unsigned int new_argc; /* argument count sans the options */
+  unsigned int new_argv_size; /* room in new_argv */
+
+  bool once; /* usage printed */
+  bool hasoptions;
+  const char *completion; /* prefix asked for by --complete, or nullptr */
+
+  AnyOptionStats stats; /* counts of the parses into this result */
+
+  AnyOptionAllocator allocator; /* for the arena chunks */
+  bool own_allocator;           /* given to the constructor */
+
+  const AnyOptionIncludeFrame *including; /* files being parsed, innermost first */
+  unsigned int file_threads; /* cap on threads parsing a file, 0 if none */
+
+  bool prepare(const AnyOption *_schema);
+  void *arenaAlloc(size_t length);
+  void *arenaTryAlloc(size_t length);
+  void resetArena();
+  void freeArena();
+  void rebase(const AnyOptionAllocator &_allocator);
+  void copyFrom(const AnyOptionResult &from);
+  bool inArena(const char *block) const;
+  void freeChunk(char *chunk);
+  void allocValues(int index, size_t length);
+
+  void storeValue(int index, const char *value, size_t length);
+  void storeFlag(int index);
+  void storeValueView(int index, const char *value, size_t length);
+  void storeBorrowedValue(int index, char *value);
+  void storeFileValue(int index, const char *value, size_t length);
+  void forgetValue(int index);
+  void copyValue(const AnyOptionResult &from, int index);
+  void takeValue(const AnyOptionResult &from, int index);
+  bool hasValue(int index) const;
+  int slotOf(const char *option) const;
+  int slotOf(char optchar) const;
+  const TypedValue &typedValue(int index, TypedKind kind);
+  static ValueStatus parseInt(const char *str, long long &value);
+  static ValueStatus parseDouble(const char *str, double &value);
+  static ValueStatus parseBool(const char *str, bool &value);
+  static ValueStatus parseSize(const char *str, unsigned long long &value);
+  static ValueStatus parseDuration(const char *str, long long &value);
+  char *valueAt(int index);
+  const char *valueAt(int index, size_t &length) const;
+  bool flagAt(int index) const;
+
+  void adoptFile(const char *mapping, size_t length);
+  void releaseFile();
+  void unmapFile();
+};
+
 class AnyOption {
 
 public: /* the public interface */
@@ -40,6 +347,15 @@ public: /* the public interface */
 
   explicit AnyOption(unsigned int maxoptions);
   explicit AnyOption(unsigned int maxoptions, unsigned int maxcharoptions);
+
+  /*
+   * registers a whole option table declared at compile time,
+   * the options get the slots found by anyOptionSlot()
+   */
+  template <size_t N> explicit AnyOption(const AnyOptionDecl (&table)[N]) {
+    init(N, N);
+    setOptions(table, N);
+  }
   ~AnyOption();
 
   /*
@@ -53,6 +369,13 @@ public: /* the public interface */
   void setFileCommentChar(char _comment);     /* '#' in shell scripts */
   void setFileDelimiterChar(char _delimiter); /* ':' in "width : 100" */
 
+  /*
+   * read the common options from the environment as well,
+   * "max-width" is APP_MAX_WIDTH with the prefix "APP_",
+   * the name is upper cased with '-' and '.' turned to '_'
+   */
+  void setEnvironmentPrefix(const char *_prefix);
+
   /*
    * provide the input for the options
    * like argv[] for commnd line and the
@@ -78,6 +401,113 @@ public: /* the public interface */
    */
   void setVerbose();
 
+  /*
+   * map the option file read only instead of reading
+   * it to memory, values stay in the mapping till they
+   * are read as C strings using getValue(), so the file
+   * must not be rewritten in place while it is mapped
+   * ( not available on Windows, falls back to reading )
+   */
+  void setFileMapping(bool _mapfile);
+
+  /*
+   * parse option files of a few MB or more on this many
+   * threads, 0 for one per core, the default 1 parses on
+   * the calling thread, later lines still win either way
+   */
+  void setFileThreads(unsigned int _threads);
+
+  /*
+   * keep a binary snapshot of the parsed option file next to
+   * it ( <filename>.cache ) and load that instead while the
+   * file's size and modification time are unchanged, the
+   * snapshot belongs to the options set, adding one rebuilds it
+   */
+  void setFileCache(bool _cache);
+
+  /*
+   * take all memory from allocator, the options, usage and
+   * file buffers, and the values of results without their
+   * own allocator, storage allocated so far is moved over,
+   * the values already parsed into the options included,
+   * returns false and keeps the old allocator if that fails
+   */
+  bool setAllocator(const AnyOptionAllocator &_allocator);
+
+  /*
+   * recognize "include <path>" lines in option files, a
+   * relative path is taken from the including file's
+   * directory, included files are read and split into
+   * options once per process and reused while their size
+   * and modification time are unchanged, cycles are skipped,
+   * the option file cache is not used with includes on
+   *
+   * clearIncludeCache() - drop the included files kept
+   */
+  void setFileIncludes(bool _includes);
+  static void clearIncludeCache();
+
+  /*
+   * time registering options and each parse, counts are
+   * kept either way, turn it on before adding options,
+   * the callback gets the stats of the result after each
+   * parse and turns instrumentation on, set both before
+   * sharing the object between threads
+   *
+   * getStats() - the registration and classic interface counts
+   */
+  typedef void (*StatsCallback)(ParsePhase phase, const AnyOptionStats &stats,
+                                void *data);
+  void setInstrumentation(bool _instrument);
+  void setStatsCallback(StatsCallback callback, void *data);
+  AnyOptionStats getStats() const;
+
+  /*
+   * the scanner splitting option files into lines, picked
+   * for the cpu on first use: "avx2", "sse2" or "scalar",
+   * can be set for all AnyOption objects before parsing,
+   * returns false if the cpu does not support it
+   */
+  static const char *getFileScanner();
+  static bool setFileScanner(const char *name);
+
+  /*
+   * keep pointers into argv for the command line values
+   * instead of copying them, argv must outlive the object
+   */
+  void setArgvBorrowing(bool _borrow);
+
+  /*
+   * expand "@path" command line arguments to the arguments
+   * in the file, split at white space with '...', "..." and
+   * \ quoting as in a shell, @path in the file expands too,
+   * a file that can't be read stays a plain argument, the
+   * arguments are kept in the result and not copied again
+   */
+  void setResponseFiles(bool _response);
+
+  /*
+   * accept an unambiguous prefix of a long option on the
+   * command line, "--verb" for "--verbose" unless another
+   * option starts with it too, a full name always wins
+   */
+  void setAbbreviations(bool _abbreviate);
+
+  /*
+   * shell completion, "--complete <prefix>" on the command
+   * line prints the long command line options starting with
+   * prefix, one per line in order, and exits, the option is
+   * named here ( "complete" ), nullptr turns it off, only
+   * the classic processCommandArgs() and processLayers()
+   * answer, parsing into a result records the prefix there
+   * and leaves answering to the caller ( getCompletion() )
+   *
+   * complete() - print the completions, returns how many,
+   *              once either setting has built the trie
+   */
+  void setCompletionOption(const char *_option);
+  unsigned int complete(const char *prefix, ostream &out) const;
+
   /*
    * there are two types of options
    *
@@ -94,31 +524,53 @@ public: /* the public interface */
    *
    * following set methods, handle all the above
    * cases of options.
+   *
+   * each returns the slot of the option, which gets
+   * its value without looking up the name again
+   *
+   *   AnyOptionSlot width = opt.setOption("width", 'w');
+   *   ...
+   *   char *value = opt.getValue(width);
    */
 
   /* options command to command line and option file */
-  void setOption(const char *opt_string);
-  void setOption(char opt_char);
-  void setOption(const char *opt_string, char opt_char);
-  void setFlag(const char *opt_string);
-  void setFlag(char opt_char);
-  void setFlag(const char *opt_string, char opt_char);
+  AnyOptionSlot setOption(const char *opt_string);
+  AnyOptionSlot setOption(char opt_char);
+  AnyOptionSlot setOption(const char *opt_string, char opt_char);
+  AnyOptionSlot setFlag(const char *opt_string);
+  AnyOptionSlot setFlag(char opt_char);
+  AnyOptionSlot setFlag(const char *opt_string, char opt_char);
 
   /* options read from command line only */
-  void setCommandOption(const char *opt_string);
-  void setCommandOption(char opt_char);
-  void setCommandOption(const char *opt_string, char opt_char);
-  void setCommandFlag(const char *opt_string);
-  void setCommandFlag(char opt_char);
-  void setCommandFlag(const char *opt_string, char opt_char);
+  AnyOptionSlot setCommandOption(const char *opt_string);
+  AnyOptionSlot setCommandOption(char opt_char);
+  AnyOptionSlot setCommandOption(const char *opt_string, char opt_char);
+  AnyOptionSlot setCommandFlag(const char *opt_string);
+  AnyOptionSlot setCommandFlag(char opt_char);
+  AnyOptionSlot setCommandFlag(const char *opt_string, char opt_char);
 
   /* options read from an option file only  */
-  void setFileOption(const char *opt_string);
-  void setFileOption(char opt_char);
-  void setFileOption(const char *opt_string, char opt_char);
-  void setFileFlag(const char *opt_string);
-  void setFileFlag(char opt_char);
-  void setFileFlag(const char *opt_string, char opt_char);
+  AnyOptionSlot setFileOption(const char *opt_string);
+  AnyOptionSlot setFileOption(char opt_char);
+  AnyOptionSlot setFileOption(const char *opt_string, char opt_char);
+  AnyOptionSlot setFileFlag(const char *opt_string);
+  AnyOptionSlot setFileFlag(char opt_char);
+  AnyOptionSlot setFileFlag(const char *opt_string, char opt_char);
+
+  /*
+   * options read from the environment only, under the name
+   * given with the prefix in front, see setEnvironmentPrefix(),
+   * a flag is set by a true value as getBool() reads it
+   */
+  AnyOptionSlot setEnvironmentOption(const char *opt_string);
+  AnyOptionSlot setEnvironmentFlag(const char *opt_string);
+
+  /*
+   * read an option of any kind from the environment variable
+   * env_name as well, without the prefix, the name is kept
+   * and not copied, returns false if nothing has the slot
+   */
+  bool setEnvironmentName(AnyOptionSlot slot, const char *env_name);
 
   /*
    * process the options, registered using
@@ -136,6 +588,63 @@ public: /* the public interface */
   void processCommandArgs(int _argc, char **_argv, int max_args);
   bool processFile(const char *_filename);
 
+  /*
+   * set the options bound to environment variables, the
+   * environment is scanned once and each variable looked
+   * up by name, values are copied, call it between the
+   * option file and the command line to give it that rank,
+   * returns false if no bound variable was set
+   */
+  bool processEnvironment();
+  bool processEnvironment(AnyOptionResult &result) const;
+  bool processEnvironment(char **envp, AnyOptionResult &result) const;
+
+  /*
+   * process the specified options into a separate result,
+   * these only read the registered options, so once all
+   * options are set a const AnyOption works as a compiled
+   * schema for parsing any number of inputs
+   *
+   * any number of threads can parse through one const
+   * AnyOption at the same time, as long as each thread
+   * uses its own result and nothing sets options meanwhile
+   */
+  void processCommandArgs(int _argc, char **_argv,
+                          AnyOptionResult &result) const;
+  void processCommandArgs(int _argc, char **_argv, int max_args,
+                          AnyOptionResult &result) const;
+  bool processFile(const char *_filename, AnyOptionResult &result) const;
+
+  /*
+   * layered configuration, the option files in order of
+   * precedence ( system, user, local ) with the command line
+   * on top, a later file overrides an earlier one and files
+   * that don't exist are skipped, each slot is written once
+   * with the value of the highest layer setting it, the
+   * environment goes between the files and the command line
+   * when options are bound to it
+   *
+   * the files are parsed at the same time, on up to a thread
+   * per core, which share the setFileThreads() threads for
+   * large files between them, returns false if none was found,
+   * the classic version takes the command line given to
+   * useCommandArgs()
+   */
+  bool processLayers(const char *const *files, unsigned int count);
+  bool processLayers(const char *const *files, unsigned int count, int _argc,
+                     char **_argv, AnyOptionResult &result) const;
+
+  /*
+   * process options in the option file format from a stream,
+   * like stdin or a pipe, read in chunks so memory stays
+   * bounded by the longest line whatever the input size,
+   * processFile() falls back to this for files it can't size
+   */
+  bool processStream(istream &in);
+  bool processStream(int fd);
+  bool processStream(istream &in, AnyOptionResult &result) const;
+  bool processStream(int fd, AnyOptionResult &result) const;
+
   /*
    * get the value of the options
    * will return NULL if no value is set
@@ -145,6 +654,46 @@ public: /* the public interface */
   char *getValue(char _optchar);
   bool getFlag(char _optchar);
 
+  /*
+   * get the value and its length without copying it,
+   * the value is not null terminated if it still refers
+   * to a mapped option file, see setFileMapping()
+   */
+  const char *getValue(const char *_option, size_t &length);
+  const char *getValue(char _optchar, size_t &length);
+
+  /*
+   * get the value of an option by its slot, without
+   * looking up the option name
+   */
+  char *getValue(AnyOptionSlot slot);
+  bool getFlag(AnyOptionSlot slot);
+
+  /*
+   * get the value converted to a type, the conversion is
+   * done once and kept till the value changes, value is
+   * left untouched unless VALUE_OK is returned
+   *
+   * getBool()     - true/false, yes/no, on/off, 1/0 or a set flag
+   * getSize()     - bytes, with an optional K, M or G suffix ( 1024 based )
+   * getDuration() - milliseconds, with an optional ms, s or m suffix
+   */
+  ValueStatus getInt(const char *_option, long long &value);
+  ValueStatus getInt(char _optchar, long long &value);
+  ValueStatus getInt(AnyOptionSlot slot, long long &value);
+  ValueStatus getDouble(const char *_option, double &value);
+  ValueStatus getDouble(char _optchar, double &value);
+  ValueStatus getDouble(AnyOptionSlot slot, double &value);
+  ValueStatus getBool(const char *_option, bool &value);
+  ValueStatus getBool(char _optchar, bool &value);
+  ValueStatus getBool(AnyOptionSlot slot, bool &value);
+  ValueStatus getSize(const char *_option, unsigned long long &value);
+  ValueStatus getSize(char _optchar, unsigned long long &value);
+  ValueStatus getSize(AnyOptionSlot slot, unsigned long long &value);
+  ValueStatus getDuration(const char *_option, long long &value);
+  ValueStatus getDuration(char _optchar, long long &value);
+  ValueStatus getDuration(AnyOptionSlot slot, long long &value);
+
   /*
    * Print Usage
    */
@@ -163,13 +712,14 @@ public: /* the public interface */
   bool hasOptions() const;
 
 private:                /* the hidden data structure */
+  friend class AnyOptionResult;
+  friend class AnyOptionWatcher;
+
   int argc;             /* command line arg count  */
   char **argv;          /* commnd line args */
   const char *filename; /* the option file */
   char *appname;        /* the application name from argv[0] */
 
-  int *new_argv;      /* arguments sans options (index to argv) */
-  unsigned int new_argc;       /* argument count sans the options */
   unsigned int max_legal_args; /* ignore extra arguments */
 
   /* option strings storage + indexing */
@@ -177,17 +727,50 @@ private:                /* the hidden data structure */
   const char **options; /* storage */
   OptionType *optiontype; /* type - common, command, file */
   int *optionindex;     /* index into value storage */
+  int *optionnext;      /* next option with the same name, -1 if none */
   unsigned int option_counter;   /* counter for added options  */
 
+  /* option strings hash index ( open addressing, linear probing ) */
+  int *optionhash;                /* index into options, -1 if empty */
+  unsigned int optionhash_size;   /* table size, always a power of two */
+
   /* option chars storage + indexing */
   unsigned int max_char_options;  /* maximum number options */
   char *optionchars;    /*  storage */
   OptionType *optchartype;     /* type - common, command, file */
   int *optcharindex;    /* index into value storage */
+  int *optcharnext;     /* next option with the same char, -1 if none */
   unsigned int optchar_counter;  /* counter for added options  */
+  int optcharmap[OPTION_CHAR_SLOTS]; /* first index into optionchars per char */
+
+  /* environment variable names ( open addressing, linear probing ) */
+  struct EnvName {
+    const char *name; /* option name, or the whole variable name if bound */
+    int value;        /* index into value storage */
+    bool flag;
+    bool bound;       /* set by setEnvironmentName(), no prefix */
+  };
+  EnvName *envnames;            /* name.name nullptr if empty */
+  unsigned int envname_size;    /* table size, 0 or a power of two */
+  unsigned int envname_count;   /* names in the table */
+  unsigned int envname_bound;   /* bound names in the table */
+  const char *env_prefix;       /* "APP_", nullptr if not set */
+
+  /* prefix trie over the long command line options */
+  struct TrieNode {
+    char ch;
+    int child;          /* first child, -1 if none */
+    int sibling;        /* next child of the parent in char order, -1 if none */
+    int option;         /* index into options named this prefix, -1 if none */
+    int below;          /* index into options of a name with this prefix */
+    unsigned int names; /* names with this prefix */
+  };
+  TrieNode *trie;            /* trie[0] is the root, nullptr if not built */
+  unsigned int trie_size;    /* nodes allocated */
+  unsigned int trie_count;   /* nodes used */
 
   /* values */
-  char **values;       /* common value storage */
+  AnyOptionResult parsed;       /* values for the classic interface */
   unsigned int g_value_counter; /* globally updated value index LAME! */
 
   /* help and usage */
@@ -215,17 +798,37 @@ private:                /* the hidden data structure */
   char nullterminate;
 
   bool set;  // was static member
-  bool once; // was static member
 
   bool hasoptions;
   bool autousage;
 
+  bool map_file;    /* map the option file, don't read it */
+  unsigned int file_threads; /* threads parsing a large option file */
+  bool file_cache;  /* load a binary snapshot of the option file */
+  bool file_includes; /* follow include lines */
+
+  AnyOptionAllocator allocator; /* all storage */
+
+  /* instrumentation */
+  bool instrument;               /* time registration and parsing */
+  StatsCallback stats_callback;  /* called after each parse */
+  void *stats_data;
+  AnyOptionStats registration;   /* registration counts */
+  bool borrow_argv; /* values point into argv, no copies */
+  bool response_files; /* expand @path arguments */
+  bool abbreviate;     /* unambiguous long option prefixes */
+  const char *completion_option; /* "complete" in --complete, or nullptr */
+
 private: /* the hidden utils */
   void init();
   void init(unsigned int maxopt, unsigned int maxcharopt);
   bool alloc();
-  void allocValues(int index, size_t length);
   void cleanup();
+  void freeStorage();
+  unsigned int storage(void *blocks[], size_t sizes[]) const;
+  void *allocBlock(size_t size) const;
+  void freeBlock(void *block, size_t size) const;
+  void *growBlock(void *block, size_t size, size_t grown) const;
   bool valueStoreOK();
 
   /* grow storage arrays as required */
@@ -233,39 +836,257 @@ private: /* the hidden utils */
   bool doubleCharStorage();
   bool doubleUsageStorage();
 
-  bool setValue(const char *option, char *value);
-  bool setFlagOn(const char *option);
-  bool setValue(char optchar, char *value);
-  bool setFlagOn(char optchar);
+  /* option strings hash index */
+  bool buildOptHash();
+  void hashOption(int index);
+  int findOption(const char *option) const;
+  int findOption(const char *option, size_t length) const;
+  static unsigned int hashString(const char *str, size_t length);
+  int findChar(char optchar) const;
+
+  /* long option prefix trie */
+  bool trieWanted() const;
+  bool buildTrie();
+  bool trieOption(int index);
+  int trieChild(int node, char ch) const;
+  int trieNode(const char *prefix, size_t length) const;
+  int findAbbreviation(const char *opt, size_t length,
+                       AnyOptionResult &result) const;
+  void printCompletions(int node, ostream &out, unsigned int &count) const;
+
+  /* environment variable names */
+  bool envNamed(OptionType type) const;
+  bool buildEnvHash(unsigned int count);
+  bool addEnvName(const EnvName &name);
+  void hashEnvName(const EnvName &name);
+  unsigned int envHash(const EnvName &name) const;
+  bool envMatch(const EnvName &name, const char *var, size_t length) const;
+  void setEnvironmentValue(const EnvName &name, const char *var, size_t length,
+                           AnyOptionResult &result) const;
+  bool parseEnvironment(char **envp, AnyOptionResult &result) const;
+
+  bool setValue(char optchar, char *value, AnyOptionResult &result) const;
+  void setCommandValue(int index, char *value, AnyOptionResult &result) const;
+  int valueIndex(const char *option, const AnyOptionResult &result) const;
+  int valueIndex(char optchar, const AnyOptionResult &result) const;
 
   void addOption(const char *option, OptionType type);
   void addOption(char optchar, OptionType type);
+  void setOptions(const AnyOptionDecl *table, unsigned int count);
   void addOptionError(const char *opt) const;
   void addOptionError(char opt) const;
-  bool findFlag(char *value);
   void addUsageError(const char *line);
   bool CommandSet() const;
   bool FileSet() const;
   bool POSIX() const;
 
-  char parsePOSIX(char *arg);
-  int parseGNU(char *arg);
-  bool matchChar(char c);
-  int matchOpt(char *opt);
+  void parseCommandArgs(int _argc, char **_argv, unsigned int max_args,
+                        AnyOptionResult &result) const;
+  void answerCompletion() const;
+
+  /* the command line arguments with response files expanded */
+  struct ArgCursor {
+    char **argv;
+    int argc;
+    int next; /* index into argv */
+    struct Response {
+      char *next;  /* the next argument, null terminated */
+      size_t left; /* arguments left in the file */
+    } responses[RESPONSE_FILE_DEPTH];
+    unsigned int depth; /* response files being read */
+  };
+  char *nextArg(ArgCursor &cursor, AnyOptionResult &result) const;
+  char *readResponseFile(const char *fname, size_t &count,
+                         AnyOptionResult &result) const;
+  void addArgument(char *arg, unsigned int max_args,
+                   AnyOptionResult &result) const;
+  char parsePOSIX(char *arg, AnyOptionResult &result) const;
+  int parseGNU(char *arg, AnyOptionResult &result) const;
+  bool matchChar(char c, AnyOptionResult &result) const;
+  int matchOpt(const char *opt, size_t length, AnyOptionResult &result) const;
 
   /* dot file methods */
-  char *readFile();
-  char *readFile(const char *fname);
-  bool consumeFile(char *buffer);
-  void processLine(char *theline, int length);
-  char *chomp(char *str);
-  void valuePairs(char *type, char *value);
-  void justValue(char *value);
+  bool parseFile(const char *fname, AnyOptionResult &result) const;
+  bool parseSource(const char *fname, AnyOptionResult &result) const;
+  void includeFile(const char *path, size_t length,
+                   AnyOptionResult &result) const;
+  void includePath(const string &path, AnyOptionResult &result) const;
+  unsigned long long startPhase() const;
+  void finishPhase(ParsePhase phase, unsigned long long start,
+                   AnyOptionResult &result) const;
+  char *readFile(const char *fname, size_t &length) const;
+  char *readFile(istream &is, size_t &length) const;
+  bool mapFile(const char *fname, AnyOptionResult &result) const;
+  bool readOrMapFile(const char *fname, AnyOptionResult &result) const;
+  bool consumeFile(const char *buffer, size_t length,
+                   AnyOptionResult &result) const;
+  bool consumeLines(const char *buffer, size_t length,
+                    AnyOptionResult &result) const;
+  bool consumeParallel(const char *buffer, size_t length, unsigned int threads,
+                       AnyOptionResult &result) const;
+  AnyOptionResult *newParts(unsigned int count) const;
+  void deleteParts(AnyOptionResult *parts, unsigned int count) const;
+  void resolveParts(AnyOptionResult *parts, unsigned int count,
+                    AnyOptionResult &result) const;
+
+  /* binary option file cache */
+  unsigned long long schemaFingerprint() const;
+  bool parseCached(const char *fname, AnyOptionResult &result) const;
+  bool loadCache(const char *cachename, const char *fname,
+                 AnyOptionResult &result) const;
+  void saveCache(const char *cachename, const char *fname,
+                 const AnyOptionResult &values) const;
+
+  /* one option line found by a file scanner */
+  struct FileToken {
+    size_t offset;    /* start of the line */
+    size_t length;    /* without the end of line */
+    size_t delimiter; /* first delimiter in the line, or NO_DELIMITER */
+  };
+  static const size_t NO_DELIMITER = (size_t)-1;
+  typedef size_t (*FileScanner)(const char *buffer, size_t length, char eol,
+                                char delim, FileToken *tokens, size_t &count);
+  static FileScanner fileScanner();
+  static size_t scanSSE2(const char *buffer, size_t length, char eol,
+                         char delim, FileToken *tokens, size_t &count);
+  static size_t scanAVX2(const char *buffer, size_t length, char eol,
+                         char delim, FileToken *tokens, size_t &count);
+  static bool scanBits(size_t at, unsigned int eols, unsigned int delims,
+                       size_t &start, size_t &delimiter, FileToken *tokens,
+                       size_t &count);
+  static size_t scanTail(const char *buffer, size_t at, size_t length, char eol,
+                         char delim, size_t start, size_t delimiter,
+                         FileToken *tokens, size_t &count);
+  bool consumeStream(size_t (*readChunk)(void *, char *, size_t), void *source,
+                     AnyOptionResult &result) const;
+  static size_t readStream(void *source, char *buffer, size_t length);
+  static size_t readDescriptor(void *source, char *buffer, size_t length);
+  int processLine(const char *theline, size_t length,
+                  AnyOptionResult &result) const;
+  int processLine(const char *theline, size_t length, size_t delimiter_at,
+                  AnyOptionResult &result) const;
+  void chomp(const char *&str, size_t &length) const;
+  int valuePairs(const char *type, size_t typelength, const char *value,
+                 size_t valuelength, AnyOptionResult &result) const;
+  int justValue(const char *type, size_t length,
+                AnyOptionResult &result) const;
+
+  void printUsage(AnyOptionResult &result) const;
+  void printAutoUsage(AnyOptionResult &result) const;
 
   void printVerbose(const char *msg) const;
   void printVerbose(char *msg) const;
+  void printVerbose(const char *msg, size_t length) const;
   void printVerbose(char ch) const;
   void printVerbose() const;
 };
 
+/*
+ * keeps the values of an option file up to date, parsing
+ * it again in the background whenever it is rewritten
+ *
+ * every parse goes into a fresh AnyOptionResult which is
+ * published whole, readers keep the snapshot they got for
+ * as long as they use it and never see a half applied file
+ *
+ *   AnyOptionWatcher watcher(opt);
+ *   watcher.onChange(width, widthChanged, &app);
+ *   watcher.start();
+ *   ...
+ *   shared_ptr<AnyOptionResult> values = watcher.snapshot();
+ *   char *width = values->getValue(width);
+ *
+ * only getValue() and getFlag() are safe to call on a snapshot
+ * shared by threads, the typed getters cache into the result
+ *
+ * the file is watched with inotify on Linux and parsed
+ * again when it is closed after writing or renamed over,
+ * elsewhere start() only parses it once, call reload() to
+ * parse again
+ */
+class AnyOptionWatcher {
+
+public:
+  typedef void (*ChangeCallback)(AnyOptionSlot slot, AnyOptionResult &values,
+                                 void *data);
+
+  explicit AnyOptionWatcher(const AnyOption &_schema);
+  ~AnyOptionWatcher();
+
+  /*
+   * parse the option file registered with useFiileName(),
+   * or the one given, and keep watching it till stop()
+   */
+  bool start();
+  bool start(const char *_filename);
+  void stop();
+
+  /*
+   * parse the option file now and publish the values,
+   * the last values are kept if the file cannot be read
+   *
+   * only the lines which differ from the last parse are
+   * processed again, changed gets the slots whose values
+   * are different from the last published ones
+   */
+  bool reload();
+  bool reload(vector<AnyOptionSlot> &changed);
+
+  /*
+   * the last published values, never null after start()
+   */
+  shared_ptr<AnyOptionResult> snapshot() const;
+
+  /*
+   * called on the watching thread after new values are
+   * published in which the option at slot has changed
+   */
+  void onChange(AnyOptionSlot slot, ChangeCallback callback, void *data);
+
+private:
+  AnyOptionWatcher(const AnyOptionWatcher &);            /* not copyable */
+  AnyOptionWatcher &operator=(const AnyOptionWatcher &); /* not copyable */
+
+  struct Listener {
+    AnyOptionSlot slot;
+    ChangeCallback callback;
+    void *data;
+  };
+
+  /* an option line of the last parsed file */
+  struct FileLine {
+    size_t offset; /* into text */
+    size_t length;
+    int slot;      /* value index set by the line, -1 if none */
+  };
+
+  const AnyOption &schema;
+  string filename;
+  shared_ptr<AnyOptionResult> current; /* swapped with atomic_store() */
+  vector<Listener> listeners;
+  mutex reloading; /* one reload() at a time, guards listeners */
+
+  thread watching;
+  int watch_fd;   /* inotify descriptor, -1 if not watching */
+  int wakeup[2];  /* pipe to stop the watching thread */
+
+  /* the last parsed file, to find what a reload changed */
+  char *text;
+  size_t text_length;
+  AnyOptionAllocator text_allocator; /* the allocator text came from */
+  vector<FileLine> lines; /* option lines in file order */
+  vector<int> lastline;   /* per slot the last line setting it, or -1 */
+  vector<int> prevline;   /* per line the previous line with its slot, or -1 */
+
+  bool startWatching();
+  void watch();
+  void forgetText();
+  void indexLines(const char *buffer, size_t begin, size_t end,
+                  AnyOptionResult &values, vector<FileLine> &found) const;
+  void linkLines();
+  static bool lineBefore(const FileLine &line, size_t offset);
+  static bool sameValue(const AnyOptionResult &a, const AnyOptionResult &b,
+                        int index);
+};
+
 #endif /* ! _ANYOPTION_H */
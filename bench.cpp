@@ -0,0 +1,950 @@
+/*
+ * Micro benchmarks for AnyOption
+ *
+ * Compile:
+ *   $ cmake -DWITH_BENCH=ON -DCMAKE_BUILD_TYPE=Release . && make bench
+ * or
+ *   $ g++ -O2 bench.cpp anyoption.cpp -o bench
+ *
+ * Run all sections, or only the named ones:
+ *   $ ./bench
+ *   $ ./bench lookup
+ *
+ * allocations are counted on glibc only, peak RSS is
+ * printed after the sections on POSIX systems
+ *
+ */
+
+#include "anyoption.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+typedef chrono::steady_clock bench_clock;
+
+static volatile size_t sink; /* keeps the measured work alive */
+
+static double nsSince(bench_clock::time_point start, size_t ops) {
+  chrono::duration<double, nano> elapsed = bench_clock::now() - start;
+  return elapsed.count() / (double)ops;
+}
+
+/*
+ * counts malloc() calls, including those behind new and
+ * inside the library, while counting is on ( single threaded )
+ */
+static bool counting = false;
+static size_t allocations = 0;
+
+#if defined(__GLIBC__)
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+  if (counting)
+    allocations++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  if (counting)
+    allocations++;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  if (counting)
+    allocations++;
+  return __libc_realloc(ptr, size);
+}
+}
+#define BENCH_ALLOCATIONS "allocs"
+#else
+#define BENCH_ALLOCATIONS "allocs(n/a)"
+#endif
+
+static void startCounting() {
+  allocations = 0;
+  counting = true;
+}
+
+static size_t stopCounting() {
+  counting = false;
+  return allocations;
+}
+
+/*
+ * the linear strcmp scan over the registered names that
+ * AnyOption used before the hash index, kept as reference
+ */
+static int linearFind(const vector<string> &names, const char *name) {
+  for (size_t i = 0; i < names.size(); i++) {
+    if (strcmp(names[i].c_str(), name) == 0)
+      return (int)i;
+  }
+  return -1;
+}
+
+static void benchLookup() {
+  const size_t lookups = 1 << 20;
+
+  cout << "option name lookup (ns/lookup)" << endl;
+  cout << "options\tlinear\thashed" << endl;
+  for (unsigned int count = 1; count <= 4096; count *= 2) {
+    vector<string> names;
+    for (unsigned int i = 0; i < count; i++)
+      names.push_back("option_name_" + to_string(i));
+
+    AnyOption opt(count);
+    for (unsigned int i = 0; i < count; i++)
+      opt.setOption(names[i].c_str());
+    opt.processOptions();
+
+    size_t found = 0;
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t i = 0; i < lookups; i++)
+      found += linearFind(names, names[i % count].c_str());
+    double linear = nsSince(start, lookups);
+
+    start = bench_clock::now();
+    for (size_t i = 0; i < lookups; i++)
+      found += (size_t)opt.getValue(names[i % count].c_str());
+    double hashed = nsSince(start, lookups);
+
+    sink = found;
+    cout << count << "\t" << linear << "\t" << hashed << endl;
+  }
+  cout << endl;
+}
+
+static const unsigned int file_options = 100;
+
+static string optionName(unsigned int i) { return "option_name_" + to_string(i); }
+
+/*
+ * writes an option file of about size bytes cycling through
+ * file_options registered option names, with some comments
+ */
+static void writeOptionFile(const char *path, size_t size) {
+  ofstream out(path);
+  size_t written = 0;
+  for (unsigned int line = 0; written < size; line++) {
+    string text;
+    if (line % 10 == 0)
+      text = "# generated comment line " + to_string(line) + "\n";
+    else
+      text = optionName(line % file_options) + " : value_" + to_string(line) + "\n";
+    out << text;
+    written += text.size();
+  }
+}
+
+static void registerFileOptions(AnyOption &opt) {
+  static vector<string> names;
+  for (unsigned int i = names.size(); i < file_options; i++)
+    names.push_back(optionName(i));
+  for (unsigned int i = 0; i < file_options; i++)
+    opt.setOption(names[i].c_str());
+}
+
+static double parseFile(const char *path, size_t size, bool mapped) {
+  const size_t rounds = min<size_t>(1000, (64 << 20) / size);
+  bench_clock::time_point start = bench_clock::now();
+  for (size_t i = 0; i < rounds; i++) {
+    AnyOption opt(file_options);
+    registerFileOptions(opt);
+    opt.setFileMapping(mapped);
+    sink = opt.processFile(path);
+  }
+  return nsSince(start, rounds * size);
+}
+
+static double streamFile(const char *path, size_t size) {
+  const size_t rounds = min<size_t>(1000, (64 << 20) / size);
+  bench_clock::time_point start = bench_clock::now();
+  for (size_t i = 0; i < rounds; i++) {
+    AnyOption opt(file_options);
+    registerFileOptions(opt);
+    ifstream in(path);
+    sink = opt.processStream(in);
+  }
+  return nsSince(start, rounds * size);
+}
+
+static size_t fileAllocations(const char *path, bool mapped) {
+  startCounting();
+  {
+    AnyOption opt(file_options);
+    registerFileOptions(opt);
+    opt.setFileMapping(mapped);
+    sink = opt.processFile(path);
+  }
+  return stopCounting();
+}
+
+static void benchFile() {
+  const char *path = "bench.options";
+  const size_t sizes[] = {1 << 10, 1 << 20, 64 << 20};
+
+  cout << "option file parsing (ns/byte)" << endl;
+  cout << "bytes\tread\tmapped\tstream\tread " << BENCH_ALLOCATIONS
+       << "\tmapped " << BENCH_ALLOCATIONS << endl;
+  for (size_t size : sizes) {
+    writeOptionFile(path, size);
+    double read = parseFile(path, size, false);
+    double mapped = parseFile(path, size, true);
+    double stream = streamFile(path, size);
+    cout << size << "\t" << read << "\t" << mapped << "\t" << stream << "\t"
+         << fileAllocations(path, false) << "\t" << fileAllocations(path, true)
+         << endl;
+  }
+  remove(path);
+  cout << endl;
+}
+
+/*
+ * the mapped file parse with each file scanner the cpu has
+ */
+static void benchScanner() {
+  const char *path = "bench.options";
+  const size_t size = 64 << 20;
+  const char *scanners[] = {"scalar", "sse2", "avx2"};
+  const string original = AnyOption::getFileScanner();
+
+  cout << "option file scanners (ns/byte, " << size << " bytes mapped)"
+       << endl;
+  writeOptionFile(path, size);
+  for (const char *scanner : scanners) {
+    if (AnyOption::setFileScanner(scanner))
+      cout << scanner << "\t" << parseFile(path, size, true) << endl;
+  }
+  AnyOption::setFileScanner(original.c_str());
+  remove(path);
+  cout << endl;
+}
+
+/*
+ * a large option file parsed on 1, 2, 4 ... threads,
+ * up to 8 or the number of cores
+ */
+static void benchParallel() {
+  const char *path = "bench.options";
+  const size_t size = 256 << 20;
+  const size_t rounds = 4;
+  const unsigned int cores = max(8u, thread::hardware_concurrency());
+
+  vector<unsigned int> counts;
+  for (unsigned int threads = 1; threads < cores; threads *= 2)
+    counts.push_back(threads);
+  counts.push_back(cores);
+
+  cout << "parallel option file parsing (" << size << " bytes mapped, "
+       << thread::hardware_concurrency() << " cores)" << endl;
+  cout << "threads\tns/byte\tspeedup" << endl;
+  writeOptionFile(path, size);
+  double single = 0;
+  for (unsigned int threads : counts) {
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t i = 0; i < rounds; i++) {
+      AnyOption opt(file_options);
+      registerFileOptions(opt);
+      opt.setFileMapping(true);
+      opt.setFileThreads(threads);
+      sink = opt.processFile(path);
+    }
+    double ns = nsSince(start, rounds * size);
+    if (threads == 1)
+      single = ns;
+    cout << threads << "\t" << ns << "\t" << single / ns << endl;
+  }
+  remove(path);
+  cout << endl;
+}
+
+/*
+ * startup with a large option file, parsing the text
+ * against loading the binary cache written by the first parse
+ */
+static double loadFile(const char *path, bool cached, size_t rounds) {
+  bench_clock::time_point start = bench_clock::now();
+  for (size_t i = 0; i < rounds; i++) {
+    AnyOption opt(file_options);
+    registerFileOptions(opt);
+    opt.setFileMapping(true);
+    opt.setFileCache(cached);
+    sink = opt.processFile(path);
+  }
+  return chrono::duration<double, milli>(bench_clock::now() - start).count() /
+         rounds;
+}
+
+static void benchCache() {
+  const char *path = "bench.options";
+  const size_t sizes[] = {1 << 20, 64 << 20};
+  const size_t rounds = 8;
+
+  cout << "option file startup (ms/load)" << endl;
+  cout << "bytes\ttext\tcached" << endl;
+  for (size_t size : sizes) {
+    writeOptionFile(path, size);
+    double text = loadFile(path, false, rounds);
+    loadFile(path, true, 1); /* writes the cache */
+    double cached = loadFile(path, true, rounds);
+    cout << size << "\t" << text << "\t" << cached << endl;
+  }
+  remove(path);
+  remove("bench.options.cache");
+  cout << endl;
+}
+
+/*
+ * three option file layers, as repeated processFile()
+ * calls and as one processLayers()
+ */
+static void benchLayers() {
+  const char *files[] = {"bench.system", "bench.user", "bench.local"};
+  const size_t sizes[] = {1 << 16, 1 << 20};
+  const size_t rounds = 32;
+
+  cout << "three option file layers (ms/load)" << endl;
+  cout << "bytes\trepeated\tlayered\tlayered 1 thread" << endl;
+  for (size_t size : sizes) {
+    for (const char *file : files)
+      writeOptionFile(file, size);
+    double timings[3];
+    for (int mode = 0; mode < 3; mode++) {
+      bench_clock::time_point start = bench_clock::now();
+      for (size_t i = 0; i < rounds; i++) {
+        AnyOption opt(file_options);
+        registerFileOptions(opt);
+        opt.setFileThreads(mode == 2 ? 1 : 0);
+        if (mode == 0) {
+          for (const char *file : files)
+            sink = opt.processFile(file);
+        } else {
+          sink = opt.processLayers(files, 3);
+        }
+      }
+      timings[mode] =
+          chrono::duration<double, milli>(bench_clock::now() - start).count() /
+          rounds;
+    }
+    cout << size * 3 << "\t" << timings[0] << "\t" << timings[1] << "\t"
+         << timings[2] << endl;
+  }
+  for (const char *file : files)
+    remove(file);
+  cout << endl;
+}
+
+/*
+ * what getenv() does, a linear scan of the environment
+ */
+static const char *linearGetenv(char **envp, const string &name) {
+  for (char **var = envp; *var != nullptr; var++) {
+    if (strncmp(*var, name.c_str(), name.size()) == 0 &&
+        (*var)[name.size()] == '=')
+      return *var + name.size() + 1;
+  }
+  return nullptr;
+}
+
+/*
+ * options read from the environment, one getenv() per
+ * option against a single hashed scan
+ */
+static void benchEnvironment() {
+  const unsigned int sizes[] = {32, 256, 2048};
+  const size_t rounds = 2000;
+
+  AnyOption opt(file_options);
+  opt.setEnvironmentPrefix("APP_");
+  registerFileOptions(opt);
+  const AnyOption &schema = opt;
+  vector<string> names;
+  for (unsigned int i = 0; i < file_options; i++) {
+    string name = "APP_" + optionName(i);
+    transform(name.begin(), name.end(), name.begin(), ::toupper);
+    names.push_back(name);
+  }
+
+  cout << file_options << " options from the environment (ns/parse)" << endl;
+  cout << "variables	getenv	scan" << endl;
+  for (unsigned int size : sizes) {
+    vector<string> vars;
+    for (unsigned int i = 0; i < size; i++) /* a few are ours */
+      vars.push_back(i % 16 == 0 ? names[(i / 16) % file_options] + "=1"
+                                 : "OTHER_VARIABLE_" + to_string(i) + "=x");
+    vector<char *> envp;
+    for (string &var : vars)
+      envp.push_back(&var[0]);
+    envp.push_back(nullptr);
+
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t r = 0; r < rounds; r++) { /* lookups only, nothing stored */
+      for (const string &name : names)
+        sink = sink + (linearGetenv(envp.data(), name) != nullptr);
+    }
+    double getenv_ns = nsSince(start, rounds);
+    AnyOptionResult result;
+    start = bench_clock::now();
+    for (size_t r = 0; r < rounds; r++) {
+      result.clear();
+      sink = schema.processEnvironment(envp.data(), result);
+    }
+    double scan_ns = nsSince(start, rounds);
+    cout << size << "\t" << getenv_ns << "\t" << scan_ns << endl;
+  }
+  cout << endl;
+}
+
+/*
+ * reloading a large option file after one line changed,
+ * incrementally and as a full parse
+ */
+static void benchReload() {
+  const char *path = "bench.options";
+  const size_t sizes[] = {1 << 20, 16 << 20};
+  const size_t rounds = 8;
+
+  cout << "option file reload after a one line change (ms/reload)" << endl;
+  cout << "bytes\tfull\tincremental" << endl;
+  for (size_t size : sizes) {
+    writeOptionFile(path, size);
+    string contents;
+    {
+      ifstream in(path);
+      contents.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    const size_t middle = contents.find("value_", contents.size() / 2);
+
+    AnyOption opt(file_options);
+    registerFileOptions(opt);
+    const AnyOption &schema = opt;
+    AnyOptionWatcher watcher(schema);
+    watcher.start(path);
+    watcher.stop(); /* reload by hand only */
+
+    double full = 0;
+    double incremental = 0;
+    for (size_t r = 0; r < rounds; r++) {
+      contents[middle + 6] = (char)('0' + r % 10);
+      {
+        ofstream out(path);
+        out << contents;
+      }
+      bench_clock::time_point start = bench_clock::now();
+      AnyOptionResult result;
+      sink = schema.processFile(path, result);
+      full += nsSince(start, rounds) / 1e6;
+
+      start = bench_clock::now();
+      vector<AnyOptionSlot> changed;
+      sink = watcher.reload(changed);
+      incremental += nsSince(start, rounds) / 1e6;
+    }
+    cout << size << "\t" << full << "\t" << incremental << endl;
+  }
+  remove(path);
+  cout << endl;
+}
+
+/*
+ * one AnyOption per parse against one const AnyOption
+ * parsing into a reused result
+ */
+static void benchBatch() {
+  const size_t parses = 1 << 16;
+  const int argc = 9;
+  char *argv[argc] = {(char *)"bench",  (char *)"--width", (char *)"640",
+                      (char *)"-v",     (char *)"--name",  (char *)"foo",
+                      (char *)"-h480",  (char *)"arg1",    (char *)"arg2"};
+
+  cout << "command line parsing (ns/parse)" << endl;
+  cout << "rebuilt	batch" << endl;
+
+  bench_clock::time_point start = bench_clock::now();
+  for (size_t i = 0; i < parses; i++) {
+    AnyOption opt;
+    opt.setOption("width");
+    opt.setOption("name");
+    opt.setOption('h');
+    opt.setFlag('v');
+    opt.processCommandArgs(argc, argv);
+    sink = opt.getArgc();
+  }
+  double rebuilt = nsSince(start, parses);
+
+  AnyOption opt;
+  opt.setOption("width");
+  opt.setOption("name");
+  opt.setOption('h');
+  opt.setFlag('v');
+  const AnyOption &schema = opt;
+  AnyOptionResult result;
+  start = bench_clock::now();
+  for (size_t i = 0; i < parses; i++) {
+    result.clear();
+    schema.processCommandArgs(argc, argv, result);
+    sink = result.getArgc();
+  }
+  double batch = nsSince(start, parses);
+
+  cout << rebuilt << "\t" << batch << endl;
+  cout << endl;
+}
+
+/*
+ * parses through one shared const AnyOption on 1 to all
+ * cores, each thread with its own result
+ */
+static void benchThreads() {
+  const size_t parses = 1 << 22;
+  const int argc = 9;
+  char *argv[argc] = {(char *)"bench",  (char *)"--width", (char *)"640",
+                      (char *)"-v",     (char *)"--name",  (char *)"foo",
+                      (char *)"-h480",  (char *)"arg1",    (char *)"arg2"};
+
+  AnyOption opt;
+  opt.setOption("width");
+  opt.setOption("name");
+  opt.setOption('h');
+  opt.setFlag('v');
+  const AnyOption &schema = opt;
+
+  const unsigned int cores = max(1u, thread::hardware_concurrency());
+
+  vector<unsigned int> counts;
+  for (unsigned int threads = 1; threads < cores; threads *= 2)
+    counts.push_back(threads);
+  counts.push_back(cores); /* finish on all cores */
+
+  cout << "concurrent command line parsing (" << parses << " parses)" << endl;
+  cout << "threads\tMparse/s\tspeedup" << endl;
+  double single = 0;
+  for (unsigned int threads : counts) {
+    vector<size_t> found(threads, 0);
+    vector<thread> workers;
+    bench_clock::time_point start = bench_clock::now();
+    for (unsigned int t = 0; t < threads; t++) {
+      workers.push_back(thread([&schema, &argv, &found, t, threads, parses]() {
+        AnyOptionResult result;
+        size_t args = 0;
+        for (size_t i = 0; i < parses / threads; i++) {
+          result.clear();
+          schema.processCommandArgs(argc, argv, result);
+          args += result.getArgc();
+        }
+        found[t] = args;
+      }));
+    }
+    for (thread &worker : workers)
+      worker.join();
+    double rate = 1e3 / nsSince(start, parses);
+    if (threads == 1)
+      single = rate;
+    for (size_t f : found)
+      sink = f;
+    cout << threads << "\t" << rate << "\t" << rate / single << endl;
+  }
+  cout << endl;
+}
+
+/*
+ * argument vectors of args options in one command line style
+ * for a schema of options named o0, o1 ... with chars a, b ...
+ * and flags named f0, f1 ... with chars A, B ...
+ */
+static const unsigned int style_options = 16;
+
+static char styleChar(unsigned int i, bool flag) {
+  return (char)((flag ? 'A' : 'a') + i % style_options);
+}
+
+static void registerStyleOptions(AnyOption &opt) {
+  static vector<string> names;
+  for (unsigned int i = names.size(); i < 2 * style_options; i++)
+    names.push_back((i < style_options ? "o" : "f") +
+                    to_string(i % style_options));
+  for (unsigned int i = 0; i < style_options; i++) {
+    opt.setOption(names[i].c_str(), styleChar(i, false));
+    opt.setFlag(names[style_options + i].c_str(), styleChar(i, true));
+  }
+}
+
+static vector<string> styleArgs(const string &style) {
+  vector<string> args;
+  args.push_back("bench");
+  for (unsigned int i = 0; i < style_options; i++) {
+    const string index = to_string(i);
+    if (style == "short") {
+      args.push_back(string("-") + styleChar(i, false));
+      args.push_back("value" + index);
+    } else if (style == "long") {
+      args.push_back("--o" + index);
+      args.push_back("value" + index);
+    } else if (style == "clustered") {
+      args.push_back(string("-") + styleChar(i, true) + styleChar(i + 1, true) +
+                     styleChar(i + 2, true) + styleChar(i, false) + "value" +
+                     index);
+    } else { /* --k=v */
+      args.push_back("--o" + index + "=value" + index);
+    }
+  }
+  return args;
+}
+
+static vector<char *> argvOf(vector<string> &args) {
+  vector<char *> argv;
+  for (string &arg : args)
+    argv.push_back(&arg[0]);
+  return argv;
+}
+
+/*
+ * one full startup: construct, register and parse
+ */
+static size_t startupAllocations(int argc, char **argv) {
+  startCounting();
+  {
+    AnyOption opt(2 * style_options);
+    registerStyleOptions(opt);
+    opt.processCommandArgs(argc, argv);
+    sink = opt.getArgc();
+  }
+  return stopCounting();
+}
+
+static void benchArgs() {
+  const size_t parses = 1 << 16;
+  const char *styles[] = {"short", "long", "clustered", "--k=v"};
+
+  cout << "command line styles (" << style_options << " options)" << endl;
+  cout << "style\tns/arg\t" << BENCH_ALLOCATIONS << "/startup" << endl;
+
+  AnyOption opt(2 * style_options);
+  registerStyleOptions(opt);
+  const AnyOption &schema = opt;
+  AnyOptionResult result;
+
+  for (const char *style : styles) {
+    vector<string> args = styleArgs(style);
+    vector<char *> argv = argvOf(args);
+    const int argc = (int)argv.size();
+
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t i = 0; i < parses; i++) {
+      result.clear();
+      schema.processCommandArgs(argc, argv.data(), result);
+      sink = result.getArgc();
+    }
+    double ns = nsSince(start, parses * (argc - 1));
+
+    cout << style << "\t" << ns << "\t" << startupAllocations(argc, argv.data())
+         << endl;
+  }
+  cout << endl;
+}
+
+/*
+ * registration and parsing cost as the schema grows, the
+ * command line always sets the same 16 options
+ */
+/*
+ * tens of thousands of positional paths, from argv
+ * and from a response file
+ */
+static void benchResponse() {
+  const unsigned int counts[] = {10000, 100000};
+  const size_t rounds = 16;
+
+  AnyOption opt(2 * style_options);
+  registerStyleOptions(opt);
+  opt.setResponseFiles(true);
+  const AnyOption &schema = opt;
+
+  cout << "positional arguments (ns/arg, " << BENCH_ALLOCATIONS << "/parse)"
+       << endl;
+  cout << "arguments	argv		@file" << endl;
+  for (unsigned int count : counts) {
+    vector<string> args;
+    args.push_back("bench");
+    {
+      ofstream paths("bench.response");
+      for (unsigned int i = 0; i < count; i++) {
+        args.push_back("/data/input/file" + to_string(i) + ".dat");
+        paths << args.back() << "\n";
+      }
+    }
+    vector<char *> argv = argvOf(args);
+    char *response[] = {(char *)"bench", (char *)"@bench.response"};
+    double timings[2];
+    size_t allocs[2];
+    for (int mode = 0; mode < 2; mode++) {
+      int argc = mode == 0 ? (int)argv.size() : 2;
+      char **args = mode == 0 ? argv.data() : response;
+      bench_clock::time_point start = bench_clock::now();
+      for (size_t i = 0; i < rounds; i++) {
+        AnyOptionResult result;
+        schema.processCommandArgs(argc, args, result);
+        sink = result.getArgc();
+      }
+      timings[mode] = nsSince(start, rounds * count);
+      startCounting();
+      {
+        AnyOptionResult result;
+        schema.processCommandArgs(argc, args, result);
+      }
+      allocs[mode] = stopCounting();
+    }
+    cout << count << "\t\t" << timings[0] << "\t" << allocs[0] << "\t"
+         << timings[1] << "\t" << allocs[1] << endl;
+  }
+  remove("bench.response");
+  cout << endl;
+}
+
+/*
+ * shell completion over a large tool, from the trie and
+ * by scanning every name, and what the trie adds to
+ * registering the options
+ */
+static void benchComplete() {
+  const unsigned int count = 800;
+  const size_t rounds = 1 << 14;
+  vector<string> names;
+  for (unsigned int i = 0; i < count; i++)
+    names.push_back("group" + to_string(i % 40) + "-option-" + to_string(i));
+  const char *prefixes[] = {"--group17-", "--group3", "--"};
+
+  double registering[2];
+  for (int trie = 0; trie < 2; trie++) {
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t r = 0; r < 64; r++) {
+      AnyOption opt(count);
+      opt.setAbbreviations(trie == 1);
+      for (const string &name : names)
+        opt.setOption(name.c_str());
+    }
+    registering[trie] = nsSince(start, 64) / 1000;
+  }
+
+  AnyOption opt(count);
+  opt.setCompletionOption("complete");
+  for (const string &name : names)
+    opt.setOption(name.c_str());
+  const AnyOption &schema = opt;
+
+  cout << "completing " << count << " options (us/query)" << endl;
+  cout << "prefix		matches	scan	trie" << endl;
+  for (const char *prefix : prefixes) {
+    ostringstream out;
+    size_t matches = 0;
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t r = 0; r < rounds; r++) {
+      out.str("");
+      matches = 0;
+      for (const string &name : names) { /* filter the names one by one */
+        if (name.compare(0, strlen(prefix) - 2, prefix + 2) == 0) {
+          out << "--" << name << "\n";
+          matches++;
+        }
+      }
+    }
+    double scan_us = nsSince(start, rounds) / 1000;
+    start = bench_clock::now();
+    for (size_t r = 0; r < rounds; r++) {
+      out.str("");
+      sink = schema.complete(prefix, out);
+    }
+    double trie_us = nsSince(start, rounds) / 1000;
+    cout << prefix << "\t" << (strlen(prefix) < 8 ? "\t" : "") << matches
+         << "\t" << scan_us << "\t" << trie_us << endl;
+  }
+  cout << "register (us)\t" << registering[0] << " without the trie, "
+       << registering[1] << " with it" << endl;
+  cout << endl;
+}
+
+static void benchSchema() {
+  const unsigned int sizes[] = {10, 100, 1000, 10000};
+
+  cout << "schema size (16 long options on the command line)" << endl;
+  cout << "options\tregister(ns/opt)\tparse(ns/arg)\t" << BENCH_ALLOCATIONS
+       << "/startup" << endl;
+
+  for (unsigned int size : sizes) {
+    vector<string> names;
+    for (unsigned int i = 0; i < size; i++)
+      names.push_back(optionName(i));
+    vector<string> args;
+    args.push_back("bench");
+    for (unsigned int i = 0; i < 16; i++) {
+      args.push_back("--" + names[(i * 7919u) % size]);
+      args.push_back("value");
+    }
+    vector<char *> argv = argvOf(args);
+    const int argc = (int)argv.size();
+
+    const size_t rounds = max(10u, 100000u / size);
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t r = 0; r < rounds; r++) {
+      AnyOption opt;
+      for (unsigned int i = 0; i < size; i++)
+        opt.setOption(names[i].c_str());
+      sink = opt.getArgc();
+    }
+    double registration = nsSince(start, rounds * size);
+
+    AnyOption opt;
+    for (unsigned int i = 0; i < size; i++)
+      opt.setOption(names[i].c_str());
+    const AnyOption &schema = opt;
+    AnyOptionResult result;
+    const size_t parses = 1 << 14;
+    start = bench_clock::now();
+    for (size_t i = 0; i < parses; i++) {
+      result.clear();
+      schema.processCommandArgs(argc, argv.data(), result);
+      sink = result.getArgc();
+    }
+    double parse = nsSince(start, parses * (argc - 1));
+
+    startCounting();
+    {
+      AnyOption startup;
+      for (unsigned int i = 0; i < size; i++)
+        startup.setOption(names[i].c_str());
+      startup.processCommandArgs(argc, argv.data());
+      sink = startup.getArgc();
+    }
+    size_t allocs = stopCounting();
+
+    cout << size << "\t" << registration << "\t" << parse << "\t" << allocs
+         << endl;
+  }
+  cout << endl;
+}
+
+/*
+ * configuration polled in a loop, by name and by slot
+ */
+static void benchGetters() {
+  const size_t gets = 1 << 22;
+  static constexpr AnyOptionDecl table[] = {
+      {"width", 'w', COMMON_OPT},  {"height", 'h', COMMON_OPT},
+      {"name", 'n', COMMON_OPT},   {"verbose", 'v', COMMON_FLAG},
+      {"debug", 'd', COMMON_FLAG}, {"threads", 't', COMMON_OPT},
+  };
+  const unsigned int count = sizeof(table) / sizeof(table[0]);
+  const int argc = 8;
+  char *argv[argc] = {(char *)"bench", (char *)"-w640", (char *)"-h480",
+                      (char *)"-v",    (char *)"--name", (char *)"foo",
+                      (char *)"-t",    (char *)"8"};
+
+  AnyOption opt(table);
+  opt.processCommandArgs(argc, argv);
+
+  cout << "getters (ns/get)" << endl;
+  cout << "getValue(name)\tgetFlag(name)\tgetValue(char)\tgetValue(slot)"
+          "\tgetInt(slot)\tatoi(getValue(name))"
+       << endl;
+
+  size_t found = 0;
+  bench_clock::time_point start = bench_clock::now();
+  for (size_t i = 0; i < gets; i++)
+    found += (size_t)opt.getValue(table[i % count].name);
+  double by_name = nsSince(start, gets);
+
+  start = bench_clock::now();
+  for (size_t i = 0; i < gets; i++)
+    found += opt.getFlag(table[i % count].name);
+  double flag_by_name = nsSince(start, gets);
+
+  start = bench_clock::now();
+  for (size_t i = 0; i < gets; i++)
+    found += (size_t)opt.getValue(table[i % count].optchar);
+  double by_char = nsSince(start, gets);
+
+  start = bench_clock::now();
+  for (size_t i = 0; i < gets; i++)
+    found += (size_t)opt.getValue(AnyOptionSlot((int)(i % count)));
+  double by_slot = nsSince(start, gets);
+
+  constexpr AnyOptionSlot threads = anyOptionSlot(table, "threads");
+  start = bench_clock::now();
+  for (size_t i = 0; i < gets; i++) {
+    long long value = 0;
+    opt.getInt(threads, value);
+    found += value;
+  }
+  double typed = nsSince(start, gets);
+
+  start = bench_clock::now();
+  for (size_t i = 0; i < gets; i++)
+    found += atoi(opt.getValue("threads"));
+  double converted = nsSince(start, gets);
+
+  sink = found;
+  cout << by_name << "\t" << flag_by_name << "\t" << by_char << "\t" << by_slot
+       << "\t" << typed << "\t" << converted << endl;
+  cout << endl;
+}
+
+static void printPeakRSS() {
+#if !defined(_WIN32)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    cout << "peak RSS (KB)\t" << usage.ru_maxrss << endl;
+#endif
+}
+
+struct BenchSection {
+  const char *name;
+  void (*run)();
+};
+
+static const BenchSection sections[] = {
+    {"args", benchArgs},
+    {"response", benchResponse},
+    {"complete", benchComplete},
+    {"schema", benchSchema},
+    {"getters", benchGetters},
+    {"lookup", benchLookup},
+    {"file", benchFile},
+    {"scanner", benchScanner},
+    {"parallel", benchParallel},
+    {"cache", benchCache},
+    {"layers", benchLayers},
+    {"environment", benchEnvironment},
+    {"reload", benchReload},
+    {"batch", benchBatch},
+    {"threads", benchThreads},
+};
+
+int main(int argc, char *argv[]) {
+  for (const BenchSection &section : sections) {
+    bool selected = (argc < 2);
+    for (int i = 1; i < argc; i++)
+      selected = selected || strcmp(argv[i], section.name) == 0;
+    if (selected)
+      section.run();
+  }
+  printPeakRSS();
+  return 0;
+}
@@ -9,9 +9,25 @@
 #include "anyoption.h"
 #include <catch2/catch.hpp>
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <stdarg.h>
 #include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 using namespace Catch::Matchers;
@@ -286,3 +302,1551 @@ TEST_CASE("Test util set functions") {
 
   delete opt;
 }
+
+TEST_CASE("Test option lookup after storage growth") {
+
+  const int count = 100;
+  const int argc = 3;
+  char **argv = buildArgv(argc, "test", "--option_99", "last_value");
+
+  AnyOption *opt = new AnyOption();
+
+  string names[count];
+  for (int i = 0; i < count; i++) {
+    names[i] = "option_" + to_string(i);
+    opt->setOption(names[i].c_str()); // grows storage and rehashes
+  }
+
+  opt->processCommandArgs(argc, argv);
+
+  REQUIRE_THAT(opt->getValue("option_99"), Equals("last_value"));
+  for (int i = 0; i < count - 1; i++)
+    REQUIRE(opt->getValue(names[i].c_str()) == NULL);
+  REQUIRE(opt->getValue("option_100") == NULL);
+  REQUIRE(opt->getValue("option_") == NULL);
+
+  delete opt;
+  clearArgv(argc, argv);
+}
+
+TEST_CASE("Test duplicate option names resolve by type") {
+
+  const int argc = 2;
+  char **argv = buildArgv(argc, "test", "--shared");
+
+  AnyOption *opt = new AnyOption();
+
+  opt->setFileOption("shared");  // first registration, file only
+  opt->setCommandFlag("shared"); // second registration, command line only
+
+  opt->processCommandArgs(argc, argv);
+
+  REQUIRE(opt->getFlag("shared") == true);
+
+  delete opt;
+  clearArgv(argc, argv);
+}
+
+TEST_CASE("Test clustered short flags") {
+
+  const int argc = 4;
+  char **argv = buildArgv(argc, "test", "-xvz", "-fout.tar", "-q");
+
+  AnyOption *opt = new AnyOption();
+
+  opt->setFlag('x');
+  opt->setFlag('v');
+  opt->setFlag('z');
+  opt->setFlag('n'); // flag not in args
+  opt->setOption('f');
+  opt->setFileFlag('q');    // first registration, file only
+  opt->setCommandFlag('q'); // second registration, command line only
+  opt->setFlag((char)0xE9); // chars above 0x7F index the table too
+
+  opt->processCommandArgs(argc, argv);
+
+  REQUIRE(opt->getFlag('x') == true);
+  REQUIRE(opt->getFlag('v') == true);
+  REQUIRE(opt->getFlag('z') == true);
+  REQUIRE(opt->getFlag('n') == false);
+  REQUIRE_THAT(opt->getValue('f'), Equals("out.tar"));
+  REQUIRE(opt->getFlag('q') == true);
+  REQUIRE(opt->getFlag((char)0xE9) == false);
+
+  delete opt;
+  clearArgv(argc, argv);
+}
+
+TEST_CASE("Test file option delimiters and line ends") {
+
+  writeOptions("# comment : ignored\n"
+               "\n"
+               "width:10\n"
+               "a:b\n"
+               "height :20\n"
+               "bad:\n"
+               "   \n"
+               "last : no end of line");
+
+  AnyOption *opt = new AnyOption();
+
+  opt->setOption("width");
+  opt->setOption('a');
+  opt->setOption("height");
+  opt->setOption("bad");
+  opt->setOption("last");
+  opt->setOption("#comment");
+
+  opt->processFile("test.options");
+
+  REQUIRE_THAT(opt->getValue("width"), Equals("10"));
+  REQUIRE_THAT(opt->getValue('a'), Equals("b"));
+  REQUIRE_THAT(opt->getValue("height"), Equals("20"));
+  REQUIRE(opt->getValue("bad") == NULL);
+  REQUIRE_THAT(opt->getValue("last"), Equals("no end of line"));
+  REQUIRE(opt->getValue("#comment") == NULL);
+
+  delete opt;
+}
+
+TEST_CASE("Test mapped file options") {
+
+  writeOptions("x\nlong_option : long_option_value\na : a_value\n");
+
+  AnyOption *opt = new AnyOption();
+
+  opt->setFlag('x');
+  opt->setOption('a');
+  opt->setOption("long_option");
+  opt->setOption("from_second_file");
+  opt->setFileMapping(true);
+
+  REQUIRE(opt->processFile("test.options") == true);
+
+  size_t length = 0;
+  const char *view = opt->getValue("long_option", length);
+  REQUIRE(length == strlen("long_option_value"));
+  REQUIRE(string(view, length) == "long_option_value");
+
+  REQUIRE(opt->getFlag('x') == true);
+  REQUIRE_THAT(opt->getValue("long_option"), Equals("long_option_value"));
+
+  // a second file releases the first mapping, keeping its values
+  std::ofstream out("test.second.options");
+  out << "from_second_file : second\n";
+  out.close();
+  REQUIRE(opt->processFile("test.second.options") == true);
+  remove("test.second.options");
+
+  REQUIRE_THAT(opt->getValue('a'), Equals("a_value"));
+  REQUIRE_THAT(opt->getValue("from_second_file"), Equals("second"));
+  REQUIRE(opt->getValue("not_defined", length) == NULL);
+
+  delete opt;
+}
+
+TEST_CASE("Test value storage across arena chunks") {
+
+  const string large(10000, 'v'); // larger than an arena chunk
+  const int argc = 6;
+  char **argv = buildArgv(argc, "test", "--large", large.c_str(), "--flag",
+                          "--small", "second");
+
+  writeOptions("small : first\nflag\n");
+
+  AnyOption *opt = new AnyOption();
+
+  opt->setOption("small");
+  opt->setOption("large");
+  opt->setFlag("flag");
+  opt->setFlag("flag_not_set");
+
+  opt->processFile("test.options");
+  REQUIRE_THAT(opt->getValue("small"), Equals("first"));
+
+  opt->processCommandArgs(argc, argv);
+
+  REQUIRE_THAT(opt->getValue("small"), Equals("second"));
+  REQUIRE_THAT(opt->getValue("large"), Equals(large));
+  REQUIRE(opt->getFlag("flag") == true);
+  REQUIRE_THAT(opt->getValue("flag"), Equals("true"));
+  REQUIRE(opt->getFlag("flag_not_set") == false);
+  REQUIRE(opt->getValue("flag_not_set") == NULL);
+
+  delete opt;
+  clearArgv(argc, argv);
+}
+
+TEST_CASE("Test borrowed argv values") {
+
+  const int argc = 6;
+  char **argv = buildArgv(argc, "test", "--name", "foo.jpg", "--size=42",
+                          "-wVALUE", "-h");
+
+  AnyOption *opt = new AnyOption();
+
+  opt->setOption("name");
+  opt->setOption("size");
+  opt->setOption('w');
+  opt->setOption('h');
+  opt->setArgvBorrowing(true);
+
+  opt->processCommandArgs(argc, argv);
+
+  REQUIRE(opt->getValue("name") == argv[2]);
+  REQUIRE(opt->getValue("size") == argv[3] + strlen("--size="));
+  REQUIRE(opt->getValue('w') == argv[4] + strlen("-w"));
+  REQUIRE_THAT(opt->getValue('w'), Equals("VALUE"));
+  REQUIRE(opt->getValue('h') == NULL);
+
+  size_t length = 0;
+  REQUIRE_THAT(opt->getValue("size", length), Equals("42"));
+  REQUIRE(length == 2);
+
+  delete opt;
+  clearArgv(argc, argv);
+}
+
+TEST_CASE("Test batch parsing into results") {
+
+  AnyOption *opt = new AnyOption();
+
+  opt->setOption("name", 'n');
+  opt->setFlag("verbose", 'v');
+  opt->setFileOption("size");
+
+  const AnyOption *schema = opt;
+
+  const int argc1 = 4;
+  char **argv1 = buildArgv(argc1, "test", "--name", "first", "arg1");
+  const int argc2 = 3;
+  char **argv2 = buildArgv(argc2, "test", "-v", "-nsecond");
+
+  AnyOptionResult first, second;
+  schema->processCommandArgs(argc1, argv1, first);
+  schema->processCommandArgs(argc2, argv2, second);
+
+  REQUIRE_THAT(first.getValue("name"), Equals("first"));
+  REQUIRE(first.getFlag('v') == false);
+  REQUIRE(first.getArgc() == 1);
+  REQUIRE_THAT(first.getArgv(0), Equals("arg1"));
+
+  REQUIRE_THAT(second.getValue('n'), Equals("second"));
+  REQUIRE(second.getFlag("verbose") == true);
+  REQUIRE(second.getArgc() == 0);
+  REQUIRE(second.hasOptions() == true);
+
+  /* the classic interface keeps its own values */
+  REQUIRE(opt->getValue("name") == NULL);
+
+  /* one result reused across inputs */
+  second.clear();
+  REQUIRE(second.getValue('n') == NULL);
+  REQUIRE(second.hasOptions() == false);
+  schema->processCommandArgs(argc1, argv1, second);
+  REQUIRE_THAT(second.getValue("name"), Equals("first"));
+  REQUIRE(second.getFlag("verbose") == false);
+
+  writeOptions("size : 42\nname : ignored\n");
+  AnyOptionResult file;
+  REQUIRE(schema->processFile("test.options", file) == true);
+  REQUIRE_THAT(file.getValue("size"), Equals("42"));
+  REQUIRE_THAT(file.getValue("name"), Equals("ignored"));
+  REQUIRE(opt->getValue("size") == NULL);
+
+  delete opt;
+  clearArgv(argc1, argv1);
+  clearArgv(argc2, argv2);
+}
+
+TEST_CASE("Test concurrent parsing against a shared schema") {
+
+  AnyOption *opt = new AnyOption();
+
+  opt->setOption("name", 'n');
+  opt->setOption("size");
+  opt->setFlag("verbose", 'v');
+
+  const AnyOption *schema = opt;
+
+  const unsigned int threads = 4;
+  const unsigned int parses = 2000;
+  vector<unsigned int> failures(threads, 0);
+  vector<thread> workers;
+
+  for (unsigned int t = 0; t < threads; t++) {
+    workers.push_back(thread([schema, t, parses, &failures]() {
+      const string name = "thread" + to_string(t);
+      const int argc = 5;
+      char **argv = buildArgv(argc, "test", "-n", name.c_str(), "--size=7",
+                              t % 2 ? "-v" : "arg");
+      AnyOptionResult result;
+      for (unsigned int i = 0; i < parses; i++) {
+        result.clear();
+        schema->processCommandArgs(argc, argv, result);
+        if (name != result.getValue("name") ||
+            strcmp(result.getValue("size"), "7") != 0 ||
+            result.getFlag('v') != (t % 2 == 1))
+          failures[t]++;
+      }
+      clearArgv(argc, argv);
+    }));
+  }
+  for (thread &worker : workers)
+    worker.join();
+
+  for (unsigned int t = 0; t < threads; t++)
+    REQUIRE(failures[t] == 0);
+
+  delete opt;
+}
+
+constexpr AnyOptionDecl test_options[] = {
+    {"width", 'w', COMMON_OPT},
+    {"verbose", 'v', COMMAND_FLAG},
+    {nullptr, 'h', COMMAND_OPT},
+    {"size", 0, FILE_OPT},
+};
+
+TEST_CASE("Test compile time option table") {
+
+  constexpr AnyOptionSlot width = anyOptionSlot(test_options, "width");
+  constexpr AnyOptionSlot verbose = anyOptionSlot(test_options, 'v');
+  constexpr AnyOptionSlot height = anyOptionSlot(test_options, 'h');
+  constexpr AnyOptionSlot size = anyOptionSlot(test_options, "size");
+  static_assert(width.index == 0 && verbose.index == 1, "table order");
+  static_assert(height.index == 2 && size.index == 3, "table order");
+
+  const int argc = 5;
+  char **argv = buildArgv(argc, "test", "-w", "640", "--verbose", "-h480");
+
+  AnyOption *opt = new AnyOption(test_options);
+  REQUIRE(opt->getValue(width) == NULL);
+
+  opt->processCommandArgs(argc, argv);
+
+  REQUIRE_THAT(opt->getValue(width), Equals("640"));
+  REQUIRE_THAT(opt->getValue("width"), Equals("640"));
+  REQUIRE(opt->getFlag(verbose) == true);
+  REQUIRE_THAT(opt->getValue(height), Equals("480"));
+  REQUIRE(opt->getValue(size) == NULL);
+  REQUIRE(opt->getValue(AnyOptionSlot(4)) == NULL);
+
+  writeOptions("size : 42\n");
+  AnyOptionResult result;
+  REQUIRE(opt->processFile("test.options", result) == true);
+  REQUIRE_THAT(result.getValue(size), Equals("42"));
+  REQUIRE(result.getFlag(verbose) == false);
+
+  delete opt;
+  clearArgv(argc, argv);
+}
+
+TEST_CASE("Test typed values") {
+
+  const int argc = 10;
+  char **argv = buildArgv(argc, "test", "--count", "-42", "--ratio=0.25",
+                          "--enabled=off", "--buffer=64K", "--timeout",
+                          "30s", "--bad=12abc", "-v");
+
+  AnyOption *opt = new AnyOption();
+
+  opt->setOption("count");
+  opt->setOption("ratio");
+  opt->setOption("enabled");
+  opt->setOption("buffer");
+  opt->setOption("timeout");
+  opt->setOption("bad");
+  opt->setOption("unset");
+  opt->setFlag("verbose", 'v');
+
+  opt->processCommandArgs(argc, argv);
+
+  long long integer = 0;
+  double real = 0;
+  bool boolean = true;
+  unsigned long long size = 0;
+  long long duration = 0;
+
+  REQUIRE(opt->getInt("count", integer) == VALUE_OK);
+  REQUIRE(integer == -42);
+  REQUIRE(opt->getDouble("ratio", real) == VALUE_OK);
+  REQUIRE(real == 0.25);
+  REQUIRE(opt->getBool("enabled", boolean) == VALUE_OK);
+  REQUIRE(boolean == false);
+  REQUIRE(opt->getBool('v', boolean) == VALUE_OK);
+  REQUIRE(boolean == true);
+  REQUIRE(opt->getSize("buffer", size) == VALUE_OK);
+  REQUIRE(size == 64 * 1024);
+  REQUIRE(opt->getDuration("timeout", duration) == VALUE_OK);
+  REQUIRE(duration == 30000);
+
+  // errors leave the value untouched
+  integer = 7;
+  REQUIRE(opt->getInt("bad", integer) == VALUE_INVALID);
+  REQUIRE(opt->getInt("bad", integer) == VALUE_INVALID);
+  REQUIRE(integer == 7);
+  REQUIRE(opt->getInt("unset", integer) == VALUE_NOT_SET);
+  REQUIRE(opt->getInt("not_defined", integer) == VALUE_NOT_SET);
+  REQUIRE(opt->getSize("count", size) == VALUE_INVALID);
+  REQUIRE(opt->getDuration("ratio", duration) == VALUE_INVALID);
+  REQUIRE(opt->getDuration("buffer", duration) == VALUE_INVALID);
+  REQUIRE(opt->getBool("count", boolean) == VALUE_INVALID);
+
+  // a new value replaces the cached conversion
+  writeOptions("count : 2M\n");
+  opt->processFile("test.options");
+  REQUIRE(opt->getInt("count", integer) == VALUE_INVALID);
+  REQUIRE(opt->getSize("count", size) == VALUE_OK);
+  REQUIRE(size == 2 * 1024 * 1024);
+
+  delete opt;
+  clearArgv(argc, argv);
+}
+
+TEST_CASE("Test option slots returned by set methods") {
+
+  const int argc = 6;
+  char **argv = buildArgv(argc, "test", "-w", "640", "--verbose", "--size",
+                          "3");
+
+  AnyOption *opt = new AnyOption();
+
+  AnyOptionSlot width = opt->setOption("width", 'w');
+  AnyOptionSlot verbose = opt->setCommandFlag("verbose");
+  AnyOptionSlot size = opt->setFileOption("size");
+  AnyOptionSlot name = opt->setOption("name");
+  AnyOptionSlot quiet = opt->setFlag('q');
+
+  REQUIRE(opt->getValue(width) == NULL);
+
+  opt->processCommandArgs(argc, argv);
+
+  REQUIRE_THAT(opt->getValue(width), Equals("640"));
+  REQUIRE(opt->getFlag(verbose) == true);
+  REQUIRE(opt->getValue(size) == NULL); /* file only */
+  REQUIRE(opt->getValue(name) == NULL);
+  REQUIRE(opt->getFlag(quiet) == false);
+
+  long long pixels = 0;
+  REQUIRE(opt->getInt(width, pixels) == VALUE_OK);
+  REQUIRE(pixels == 640);
+
+  AnyOptionResult result;
+  const AnyOption *schema = opt;
+  schema->processCommandArgs(argc, argv, result);
+  REQUIRE_THAT(result.getValue(width), Equals("640"));
+  REQUIRE(result.getFlag(verbose) == true);
+
+  delete opt;
+  clearArgv(argc, argv);
+}
+
+struct TestChanges {
+  mutex lock;
+  condition_variable changed;
+  vector<string> widths;
+};
+
+static void widthChanged(AnyOptionSlot slot, AnyOptionResult &values,
+                         void *data) {
+  TestChanges *changes = (TestChanges *)data;
+  lock_guard<mutex> lock(changes->lock);
+  const char *width = values.getValue(slot);
+  changes->widths.push_back(width != NULL ? width : "");
+  changes->changed.notify_all();
+}
+
+TEST_CASE("Test option file reload") {
+
+  writeOptions("width : 100\nheight : 50\n");
+
+  AnyOption *opt = new AnyOption();
+  AnyOptionSlot width = opt->setOption("width");
+  AnyOptionSlot height = opt->setOption("height");
+  opt->useFiileName("test.options");
+
+  TestChanges changes;
+  AnyOptionWatcher *watcher = new AnyOptionWatcher(*opt);
+  watcher->onChange(width, widthChanged, &changes);
+  REQUIRE(watcher->start() == true);
+
+  shared_ptr<AnyOptionResult> first = watcher->snapshot();
+  REQUIRE_THAT(first->getValue(width), Equals("100"));
+  REQUIRE(changes.widths.size() == 1);
+
+  // an unchanged option does not call back
+  writeOptions("width : 100\nheight : 60\n");
+  REQUIRE(watcher->reload() == true);
+  REQUIRE_THAT(watcher->snapshot()->getValue(height), Equals("60"));
+  REQUIRE(changes.widths.size() == 1);
+
+  // a rewrite is picked up in the background
+  writeOptions("width : 200\nheight : 60\n");
+  {
+    unique_lock<mutex> lock(changes.lock);
+    changes.changed.wait_for(lock, chrono::seconds(5), [&changes]() {
+      return changes.widths.size() > 1;
+    });
+  }
+  REQUIRE(changes.widths.size() >= 2);
+  REQUIRE(changes.widths.back() == "200");
+  REQUIRE_THAT(watcher->snapshot()->getValue(width), Equals("200"));
+
+  // a file written in steps is read once it is closed
+  remove("test.options");
+  size_t seen = changes.widths.size();
+  {
+    ofstream out("test.options");
+    out.flush();
+    usleep(100000); /* created empty first */
+    out << "width : 300\nheight : 60\n";
+  }
+  {
+    unique_lock<mutex> lock(changes.lock);
+    changes.changed.wait_for(lock, chrono::seconds(5), [&changes, seen]() {
+      return changes.widths.size() > seen;
+    });
+  }
+  usleep(100000); /* nothing else on the way */
+  {
+    lock_guard<mutex> lock(changes.lock);
+    REQUIRE(changes.widths.size() == seen + 1);
+    REQUIRE(changes.widths.back() == "300");
+  }
+  REQUIRE_THAT(watcher->snapshot()->getValue(width), Equals("300"));
+
+  // readers keep the values they got
+  REQUIRE_THAT(first->getValue(width), Equals("100"));
+
+  // a missing file keeps the last values
+  REQUIRE(watcher->start("test.missing.options") == false);
+  REQUIRE_THAT(watcher->snapshot()->getValue(width), Equals("300"));
+
+  watcher->stop();
+  delete watcher;
+  delete opt;
+}
+
+/*
+ * reloads contents and checks the values and changes
+ * against a full parse of the same file
+ */
+static vector<int> reloadAndCompare(AnyOptionWatcher &watcher,
+                                    const AnyOption &schema,
+                                    const vector<AnyOptionSlot> &slots,
+                                    const string &contents,
+                                    vector<string> &last) {
+  writeOptions(contents);
+  vector<AnyOptionSlot> changed;
+  REQUIRE(watcher.reload(changed) == true);
+  shared_ptr<AnyOptionResult> values = watcher.snapshot();
+  AnyOptionResult full;
+  schema.processFile("test.options", full);
+
+  vector<int> expected;
+  for (size_t i = 0; i < slots.size(); i++) {
+    const char *value = values->getValue(slots[i]);
+    const char *wanted = full.getValue(slots[i]);
+    REQUIRE(string(value != NULL ? value : "-") ==
+            string(wanted != NULL ? wanted : "-"));
+    if (last[i] != (value != NULL ? value : "-"))
+      expected.push_back(slots[i].index);
+    last[i] = value != NULL ? value : "-";
+  }
+  vector<int> found;
+  for (size_t i = 0; i < changed.size(); i++)
+    found.push_back(changed[i].index);
+  sort(found.begin(), found.end());
+  REQUIRE(found == expected);
+  return found;
+}
+
+TEST_CASE("Test incremental option file reload") {
+
+  AnyOption *opt = new AnyOption();
+  vector<AnyOptionSlot> slots;
+  slots.push_back(opt->setOption("a"));
+  slots.push_back(opt->setOption("b"));
+  slots.push_back(opt->setOption("c"));
+  slots.push_back(opt->setOption("d"));
+  slots.push_back(opt->setFlag("flag"));
+  vector<string> last(slots.size(), "-");
+
+  AnyOptionWatcher *watcher = new AnyOptionWatcher(*opt);
+  writeOptions("");
+  REQUIRE(watcher->start("test.options") == true);
+  watcher->stop();
+
+  const string base = "a : 1\nb : 2\n# c : 9\nc : 3\na : 4\nflag\n";
+  REQUIRE(reloadAndCompare(*watcher, *opt, slots, base, last).size() == 4);
+  REQUIRE(reloadAndCompare(*watcher, *opt, slots,
+                           "a : 1\nb : 20\n# c : 9\nc : 3\na : 4\nflag\n", last)
+              .size() == 1);
+  // the last a removed, back to the first one
+  reloadAndCompare(*watcher, *opt, slots,
+                   "a : 1\nb : 20\n# c : 9\nc : 3\nflag\n", last);
+  REQUIRE(last[0] == "1");
+  // flag removed, a last line without an end of line
+  reloadAndCompare(*watcher, *opt, slots, "a : 1\nb : 20\n# c : 9\nc : 3\nd : 5",
+                   last);
+  reloadAndCompare(*watcher, *opt, slots,
+                   "a : 1\nb : 20\n# c : 9\nc : 3\nd : 55\n", last);
+  // an earlier c is overridden by the unchanged later one
+  REQUIRE(reloadAndCompare(*watcher, *opt, slots,
+                           "c : 0\na : 1\nb : 20\n# c : 9\nc : 3\nd : 55\n", last)
+              .empty());
+  reloadAndCompare(*watcher, *opt, slots, "c : 0\na : 1\nb : 20\nd : 55\n", last);
+  REQUIRE(last[2] == "0");
+  reloadAndCompare(*watcher, *opt, slots, "", last);
+
+  // random line edits
+  const char *names[] = {"a", "b", "c", "d", "flag", "unknown", "# a"};
+  vector<string> lines;
+  unsigned int seed = 12345;
+  for (int round = 0; round < 300; round++) {
+    seed = seed * 1103515245u + 12345u;
+    unsigned int pick = (seed >> 8) % 1000;
+    string line = names[pick % 7];
+    if (pick % 7 < 4)
+      line += " : " + to_string(pick % 5);
+    size_t at = lines.empty() ? 0 : (seed >> 4) % lines.size();
+    if (lines.empty() || pick % 3 == 0)
+      lines.insert(lines.begin() + at, line);
+    else if (pick % 3 == 1)
+      lines[at] = line;
+    else
+      lines.erase(lines.begin() + at);
+    string contents;
+    for (size_t i = 0; i < lines.size(); i++)
+      contents += lines[i] + (i + 1 < lines.size() || pick % 2 ? "\n" : "");
+    reloadAndCompare(*watcher, *opt, slots, contents, last);
+  }
+
+  delete watcher;
+  delete opt;
+}
+
+TEST_CASE("Test streamed option files") {
+
+  // lines straddling chunk boundaries, a line longer than a chunk
+  const string large(100000, 'v');
+  string contents;
+  for (int i = 0; i < 10000; i++)
+    contents += "count : " + to_string(i) + "\n# comment " + to_string(i) + "\n";
+  contents += "large : " + large + "\nflag\nlast : no end of line";
+
+  AnyOption *opt = new AnyOption();
+  AnyOptionSlot count = opt->setOption("count");
+  AnyOptionSlot large_value = opt->setOption("large");
+  AnyOptionSlot flag = opt->setFlag("flag");
+  AnyOptionSlot last = opt->setOption("last");
+
+  istringstream in(contents);
+  REQUIRE(opt->processStream(in) == true);
+  REQUIRE_THAT(opt->getValue(count), Equals("9999"));
+  REQUIRE_THAT(opt->getValue(large_value), Equals(large));
+  REQUIRE(opt->getFlag(flag) == true);
+  REQUIRE_THAT(opt->getValue(last), Equals("no end of line"));
+
+  const AnyOption *schema = opt;
+  AnyOptionResult result;
+  istringstream empty("");
+  REQUIRE(schema->processStream(empty, result) == true);
+  REQUIRE(result.getValue(count) == NULL);
+
+  // overwriting a value reuses its storage
+  string counts;
+  for (int i = 0; i < 10000; i++)
+    counts += "count : " + to_string(i) + "\n";
+  istringstream repeated(counts);
+  AnyOptionResult overwritten;
+  REQUIRE(schema->processStream(repeated, overwritten) == true);
+  REQUIRE_THAT(overwritten.getValue(count), Equals("9999"));
+  REQUIRE(overwritten.getStats().allocations < 10);
+
+#if !defined(_WIN32)
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  thread writer([&fds]() {
+    const char *lines = "count : 1\nla";
+    ssize_t written = write(fds[1], lines, strlen(lines));
+    usleep(1000);
+    written += write(fds[1], "st : piped\n", 11);
+    (void)written; /* checked by the values read */
+    close(fds[1]);
+  });
+  AnyOptionResult piped;
+  REQUIRE(schema->processStream(fds[0], piped) == true);
+  writer.join();
+  close(fds[0]);
+  REQUIRE_THAT(piped.getValue(count), Equals("1"));
+  REQUIRE_THAT(piped.getValue(last), Equals("piped"));
+
+  // processFile() streams what it can't size or map
+  for (int mapped = 0; mapped < 2; mapped++) {
+    opt->setFileMapping(mapped == 1);
+    remove("test.fifo");
+    REQUIRE(mkfifo("test.fifo", 0600) == 0);
+    thread feeder([]() {
+      ofstream out("test.fifo");
+      out << "count : 2\n";
+    });
+    usleep(20000); /* the writer waiting in open() first */
+    AnyOptionResult fifo;
+    REQUIRE(schema->processFile("test.fifo", fifo) == true);
+    feeder.join();
+    remove("test.fifo");
+    REQUIRE_THAT(fifo.getValue(count), Equals("2"));
+  }
+#endif
+
+  delete opt;
+}
+
+TEST_CASE("Test vectorized file scanners") {
+
+  // lines across 16 and 32 byte blocks, more lines than one
+  // scan holds, values with delimiters in them
+  string contents = "\n# comment : not an option\n\n";
+  for (int i = 0; i < 700; i++) {
+    contents += "count : " + to_string(i) + "\n";
+    contents += string(i % 37, 'x') + "\n";
+    contents += "url : http://host:" + to_string(i) + "/path\n";
+  }
+  contents += ":start\nend:\nflag\nlast : no end of line";
+
+  const string original = AnyOption::getFileScanner();
+  REQUIRE(AnyOption::setFileScanner("scalar") == true);
+  REQUIRE(AnyOption::setFileScanner("mmx") == false);
+
+  const char *scanners[] = {"scalar", "sse2", "avx2"};
+  for (const char *scanner : scanners) {
+    if (!AnyOption::setFileScanner(scanner))
+      continue; /* not on this cpu */
+    REQUIRE_THAT(AnyOption::getFileScanner(), Equals(scanner));
+
+    AnyOption *opt = new AnyOption();
+    AnyOptionSlot count = opt->setOption("count");
+    AnyOptionSlot url = opt->setOption("url");
+    AnyOptionSlot flag = opt->setFlag("flag");
+    AnyOptionSlot last = opt->setOption("last");
+    istringstream in(contents);
+    REQUIRE(opt->processStream(in) == true);
+    REQUIRE_THAT(opt->getValue(count), Equals("699"));
+    REQUIRE_THAT(opt->getValue(url), Equals("http://host:699/path"));
+    REQUIRE(opt->getFlag(flag) == true);
+    REQUIRE_THAT(opt->getValue(last), Equals("no end of line"));
+    delete opt;
+  }
+
+  REQUIRE(AnyOption::setFileScanner(original.c_str()) == true);
+}
+
+TEST_CASE("Test parallel option file parsing") {
+
+  // every option set in every part, the last line must win
+  string contents;
+  for (int i = 0; contents.size() < 5 * FILE_THREAD_CHUNK; i++) {
+    contents += "option" + to_string(i % 50) + " : " + to_string(i) + "\n";
+    if (i % 1000 == 0)
+      contents += "# comment\nflag\n";
+  }
+  contents += "option7 : last\noption8 : no end of line";
+  {
+    ofstream out("test.options");
+    out << contents;
+  }
+
+  AnyOption *opt = new AnyOption();
+  vector<string> names; /* setOption() keeps the pointers */
+  for (int i = 0; i < 50; i++)
+    names.push_back("option" + to_string(i));
+  vector<AnyOptionSlot> slots;
+  for (const string &name : names)
+    slots.push_back(opt->setOption(name.c_str()));
+  AnyOptionSlot flag = opt->setFlag("flag");
+  const AnyOption *schema = opt;
+
+  for (int mapped = 0; mapped < 2; mapped++) {
+    opt->setFileMapping(mapped == 1);
+    AnyOptionResult sequential;
+    opt->setFileThreads(1);
+    REQUIRE(schema->processFile("test.options", sequential) == true);
+    REQUIRE_THAT(sequential.getValue(slots[7]), Equals("last"));
+    REQUIRE_THAT(sequential.getValue(slots[8]), Equals("no end of line"));
+
+    const unsigned int threads[] = {0, 2, 3, 8};
+    for (unsigned int count : threads) {
+      AnyOptionResult parallel;
+      opt->setFileThreads(count);
+      REQUIRE(schema->processFile("test.options", parallel) == true);
+      for (AnyOptionSlot slot : slots)
+        REQUIRE_THAT(parallel.getValue(slot), Equals(sequential.getValue(slot)));
+      REQUIRE(parallel.getFlag(flag) == true);
+    }
+  }
+
+  opt->setFileThreads(4);
+  REQUIRE(opt->processFile("test.options") == true);
+  REQUIRE_THAT(opt->getValue(slots[7]), Equals("last"));
+
+  remove("test.options");
+  delete opt;
+}
+
+TEST_CASE("Test option file cache") {
+
+  remove("test.options.cache");
+  {
+    ofstream out("test.options");
+    out << "name : first\nflag\n";
+  }
+
+  AnyOption *opt = new AnyOption();
+  AnyOptionSlot name = opt->setOption("name");
+  AnyOptionSlot flag = opt->setFlag("flag");
+  AnyOptionSlot other = opt->setOption("other");
+  opt->setFileCache(true);
+  const AnyOption *schema = opt;
+
+  // command line values stay out of the cache
+  int argc = 3;
+  char *argv[] = {(char *)"test", (char *)"--other", (char *)"cli"};
+  opt->processCommandArgs(argc, argv);
+  REQUIRE(opt->processFile("test.options") == true);
+  REQUIRE_THAT(opt->getValue(name), Equals("first"));
+  REQUIRE_THAT(opt->getValue(other), Equals("cli"));
+  REQUIRE(ifstream("test.options.cache").good());
+
+  for (int mapped = 0; mapped < 2; mapped++) {
+    opt->setFileMapping(mapped == 1);
+    AnyOptionResult cached;
+    REQUIRE(schema->processFile("test.options", cached) == true);
+    REQUIRE_THAT(cached.getValue(name), Equals("first"));
+    REQUIRE(cached.getFlag(flag) == true);
+    REQUIRE(cached.getValue(other) == NULL);
+  }
+
+  // a damaged cache is rebuilt, "first" ends the cache
+  {
+    fstream cache("test.options.cache", ios::in | ios::out | ios::binary);
+    cache.seekp(-1, ios::end);
+    cache.put('X');
+  }
+  AnyOptionResult damaged;
+  REQUIRE(schema->processFile("test.options", damaged) == true);
+  REQUIRE_THAT(damaged.getValue(name), Equals("first"));
+
+#if defined(__linux__)
+  // same size and modification time, the cache is used
+  struct stat st;
+  REQUIRE(stat("test.options", &st) == 0);
+  {
+    ofstream out("test.options");
+    out << "name : fir2t\nflag\n";
+  }
+  struct timespec times[2] = {st.st_atim, st.st_mtim};
+  REQUIRE(utimensat(AT_FDCWD, "test.options", times, 0) == 0);
+  AnyOptionResult stale;
+  REQUIRE(schema->processFile("test.options", stale) == true);
+  REQUIRE_THAT(stale.getValue(name), Equals("first"));
+#endif
+
+  // the text changed
+  {
+    ofstream out("test.options");
+    out << "name : second\n";
+  }
+  AnyOptionResult changed;
+  REQUIRE(schema->processFile("test.options", changed) == true);
+  REQUIRE_THAT(changed.getValue(name), Equals("second"));
+  REQUIRE(changed.getFlag(flag) == false);
+
+  // a different schema does not use it
+  AnyOption *grown = new AnyOption();
+  grown->setOption("extra");
+  AnyOptionSlot grown_name = grown->setOption("name");
+  grown->setFileCache(true);
+  REQUIRE(grown->processFile("test.options") == true);
+  REQUIRE_THAT(grown->getValue(grown_name), Equals("second"));
+
+  delete grown;
+  delete opt;
+  remove("test.options.cache");
+  remove("test.options");
+}
+
+struct PhaseLog {
+  vector<ParsePhase> phases;
+  unsigned long long lines;
+};
+
+static void logPhase(ParsePhase phase, const AnyOptionStats &stats,
+                     void *data) {
+  PhaseLog *log = (PhaseLog *)data;
+  log->phases.push_back(phase);
+  log->lines = stats.lines;
+}
+
+TEST_CASE("Test parser instrumentation") {
+
+  const string contents = "# comment\nname : file\nverbose\n";
+  {
+    ofstream out("test.options");
+    out << contents;
+  }
+
+  AnyOption *opt = new AnyOption();
+  opt->setInstrumentation(true);
+  vector<string> names; /* setOption() keeps the pointers */
+  for (int i = 0; i < 20; i++)
+    names.push_back("option" + to_string(i));
+  for (const string &name : names)
+    opt->setOption(name.c_str());
+  AnyOptionSlot name = opt->setOption("name");
+  opt->setFlag("verbose", 'v');
+
+  AnyOptionStats stats = opt->getStats();
+  REQUIRE(stats.allocations >= 4); /* option storage doubled */
+  REQUIRE(stats.allocated_bytes > 0);
+  REQUIRE(stats.register_ns > 0);
+  REQUIRE(stats.lines == 0);
+
+  int argc = 4;
+  char *argv[] = {(char *)"test", (char *)"--name", (char *)"cli", (char *)"-v"};
+  opt->processCommandArgs(argc, argv);
+  stats = opt->getStats();
+  REQUIRE(stats.lookups >= 4);
+  REQUIRE(stats.allocations >= 5);
+  REQUIRE(stats.command_ns > 0);
+  REQUIRE(stats.file_ns == 0);
+
+  REQUIRE(opt->processFile("test.options") == true);
+  stats = opt->getStats();
+  REQUIRE(stats.file_bytes == contents.size());
+  REQUIRE(stats.lines == 2);
+  REQUIRE(stats.file_ns > 0);
+
+  // per result counts and the callback
+  PhaseLog log;
+  opt->setStatsCallback(logPhase, &log);
+  const AnyOption *schema = opt;
+  AnyOptionResult result;
+  schema->processCommandArgs(argc, argv, result);
+  REQUIRE(schema->processFile("test.options", result) == true);
+  REQUIRE_THAT(result.getValue(name), Equals("file"));
+  REQUIRE(result.getStats().lines == 2);
+  REQUIRE(result.getStats().register_ns == 0);
+  REQUIRE(log.phases.size() == 2);
+  REQUIRE(log.phases[0] == PARSE_COMMAND);
+  REQUIRE(log.phases[1] == PARSE_FILE);
+  REQUIRE(log.lines == 2);
+
+  result.clear();
+  REQUIRE(result.getStats().lines == 0);
+
+  remove("test.options");
+  delete opt;
+}
+
+struct CountingPool { /* not locked, allocator calls are serialized */
+  map<void *, size_t> blocks; /* live blocks and their sizes */
+  size_t allocations;
+  bool sizes_matched;
+};
+
+static void *poolAllocate(size_t size, void *data) {
+  CountingPool *pool = (CountingPool *)data;
+  void *block = malloc(size);
+  pool->blocks[block] = size;
+  pool->allocations++;
+  return block;
+}
+
+static void poolDeallocate(void *block, size_t size, void *data) {
+  CountingPool *pool = (CountingPool *)data;
+  map<void *, size_t>::iterator found = pool->blocks.find(block);
+  pool->sizes_matched = pool->sizes_matched && found != pool->blocks.end() &&
+                        found->second == size;
+  if (found != pool->blocks.end())
+    pool->blocks.erase(found);
+  free(block);
+}
+
+TEST_CASE("Test pluggable allocator") {
+
+  string contents;
+  for (int i = 0; contents.size() < 3 * FILE_THREAD_CHUNK; i++)
+    contents += "option" + to_string(i % 30) + " : " + to_string(i) + "\n";
+  {
+    ofstream out("test.options");
+    out << contents;
+  }
+
+  CountingPool pool = {map<void *, size_t>(), 0, true};
+  CountingPool values = {map<void *, size_t>(), 0, true};
+  {
+    AnyOption opt;
+    opt.addUsage("usage: test [options]");
+    opt.setOption("early");
+    AnyOptionAllocator allocator = {poolAllocate, poolDeallocate, &pool};
+    REQUIRE(opt.setAllocator(allocator) == true);
+    REQUIRE(pool.blocks.size() == 10); /* moved over */
+
+    vector<string> names; /* setOption() keeps the pointers */
+    for (int i = 0; i < 30; i++)
+      names.push_back("option" + to_string(i));
+    for (const string &name : names)
+      opt.setOption(name.c_str(), name[6]);
+    for (int i = 0; i < 10; i++)
+      opt.addUsage("more usage");
+
+    int argc = 3;
+    char *argv[] = {(char *)"test", (char *)"--early", (char *)"value"};
+    opt.processCommandArgs(argc, argv);
+    REQUIRE(opt.processFile("test.options") == true);
+    REQUIRE_THAT(opt.getValue("early"), Equals("value"));
+    size_t before = pool.allocations;
+
+    // read, mapped, streamed and parallel parses
+    const AnyOption *schema = &opt;
+    AnyOptionResult result;
+    REQUIRE(schema->processFile("test.options", result) == true);
+    opt.setFileMapping(true);
+    opt.setFileThreads(3);
+    REQUIRE(schema->processFile("test.options", result) == true);
+    istringstream in(contents);
+    REQUIRE(schema->processStream(in, result) == true);
+    REQUIRE(pool.allocations > before);
+
+    // a result with its own allocator only keeps its values there
+    AnyOptionAllocator value_allocator = {poolAllocate, poolDeallocate, &values};
+    AnyOptionResult own(value_allocator);
+    before = pool.allocations;
+    opt.setFileMapping(false);
+    opt.setFileThreads(1);
+    REQUIRE(schema->processFile("test.options", own) == true);
+    REQUIRE_THAT(own.getValue("option29"), Equals(result.getValue("option29")));
+    REQUIRE(values.allocations > 0);
+    REQUIRE(pool.allocations == before + 1); /* the file buffer */
+  }
+  REQUIRE(pool.blocks.empty());
+  REQUIRE(pool.sizes_matched);
+  REQUIRE(values.blocks.empty());
+  REQUIRE(values.sizes_matched);
+
+  // values parsed before the allocator is set move over too
+  CountingPool late = {map<void *, size_t>(), 0, true};
+  {
+    AnyOption opt;
+    opt.setOption("early");
+    opt.setFlag("flag");
+    int argc = 5;
+    char *argv[] = {(char *)"test", (char *)"--early", (char *)"value",
+                    (char *)"--flag", (char *)"extra"};
+    opt.processCommandArgs(argc, argv);
+    REQUIRE(opt.processFile("test.options") == true);
+    AnyOptionAllocator allocator = {poolAllocate, poolDeallocate, &late};
+    REQUIRE(opt.setAllocator(allocator) == true);
+    REQUIRE(late.blocks.size() > 10); /* the schema and the values */
+    REQUIRE_THAT(opt.getValue("early"), Equals("value"));
+    REQUIRE(opt.getFlag("flag"));
+    REQUIRE(opt.getArgc() == 1);
+    REQUIRE_THAT(opt.getArgv(0), Equals("extra"));
+    size_t before = late.allocations;
+    REQUIRE(opt.processFile("test.options") == true);
+    REQUIRE_THAT(opt.getValue("early"), Equals("value"));
+    REQUIRE(late.allocations > before);
+  }
+  REQUIRE(late.blocks.empty());
+  REQUIRE(late.sizes_matched);
+
+  // a watcher frees its last file with the allocator it came from
+  CountingPool watched = {map<void *, size_t>(), 0, true};
+  {
+    AnyOption opt;
+    opt.setOption("option1");
+    AnyOptionWatcher watcher(opt);
+    REQUIRE(watcher.start("test.options") == true);
+    watcher.stop();
+    AnyOptionAllocator allocator = {poolAllocate, poolDeallocate, &watched};
+    REQUIRE(opt.setAllocator(allocator) == true);
+    REQUIRE(watcher.reload() == true);
+    REQUIRE(watcher.reload() == true);
+  }
+  REQUIRE(watched.blocks.empty());
+  REQUIRE(watched.sizes_matched);
+
+  remove("test.options");
+}
+
+TEST_CASE("Test layered option files") {
+
+  {
+    ofstream system("test.system");
+    system << "width : 10\nheight : 20\ncolor : red\nverbose\n";
+    ofstream user("test.user");
+    user << "width : 30\nname : user\n";
+    ofstream local("test.local");
+    local << "width : 50\nheight : 60\n";
+  }
+  const char *files[] = {"test.system", "test.missing", "test.user",
+                         "test.local"};
+
+  AnyOption *opt = new AnyOption();
+  AnyOptionSlot width = opt->setOption("width");
+  AnyOptionSlot height = opt->setOption("height");
+  AnyOptionSlot color = opt->setOption("color");
+  AnyOptionSlot name = opt->setOption("name");
+  AnyOptionSlot verbose = opt->setFlag("verbose");
+  AnyOptionSlot unset = opt->setOption("unset");
+  const AnyOption *schema = opt;
+
+  int argc = 4;
+  char *argv[] = {(char *)"test", (char *)"--height", (char *)"70",
+                  (char *)"arg"};
+  for (int mapped = 0; mapped < 2; mapped++) {
+    for (unsigned int threads = 0; threads < 2; threads++) {
+      opt->setFileMapping(mapped == 1);
+      opt->setFileThreads(threads);
+      AnyOptionResult result;
+      REQUIRE(schema->processLayers(files, 4, argc, argv, result) == true);
+      REQUIRE_THAT(result.getValue(width), Equals("50"));
+      REQUIRE_THAT(result.getValue(height), Equals("70"));
+      REQUIRE_THAT(result.getValue(color), Equals("red"));
+      REQUIRE_THAT(result.getValue(name), Equals("user"));
+      REQUIRE(result.getFlag(verbose) == true);
+      REQUIRE(result.getValue(unset) == NULL);
+      REQUIRE(result.getArgc() == 1);
+      REQUIRE_THAT(result.getArgv(0), Equals("arg"));
+      REQUIRE(result.getStats().lines == 8);
+    }
+  }
+
+  AnyOptionResult none;
+  const char *missing[] = {"test.missing"};
+  REQUIRE(schema->processLayers(missing, 1, 0, nullptr, none) == false);
+
+  opt->useCommandArgs(argc, argv);
+  REQUIRE(opt->processLayers(files, 4) == true);
+  REQUIRE_THAT(opt->getValue(width), Equals("50"));
+  REQUIRE_THAT(opt->getValue(height), Equals("70"));
+  REQUIRE(opt->getArgc() == 1);
+
+  delete opt;
+  remove("test.system");
+  remove("test.user");
+  remove("test.local");
+}
+
+#if !defined(_WIN32)
+TEST_CASE("Test option file includes") {
+
+  REQUIRE((mkdir("test.d", 0700) == 0 || errno == EEXIST));
+  {
+    ofstream main("test.options");
+    main << "width : 10\ninclude test.d/common.options\nheight : 30\n"
+            "include test.d/missing.options\ninclude : not a directive\n";
+    ofstream common("test.d/common.options");
+    common << "width : 20\nheight : 20\ninclude nested.options\n";
+    ofstream nested("test.d/nested.options");
+    nested << "color : blue\nverbose\ninclude ../test.options\n"; /* a cycle */
+  }
+
+  AnyOption *opt = new AnyOption();
+  AnyOptionSlot width = opt->setOption("width");
+  AnyOptionSlot height = opt->setOption("height");
+  AnyOptionSlot color = opt->setOption("color");
+  AnyOptionSlot verbose = opt->setFlag("verbose");
+  AnyOptionSlot include = opt->setOption("include");
+  const AnyOption *schema = opt;
+
+  AnyOptionResult plain;
+  REQUIRE(schema->processFile("test.options", plain) == true);
+  REQUIRE_THAT(plain.getValue(width), Equals("10"));
+  REQUIRE(plain.getValue(color) == NULL);
+
+  opt->setFileIncludes(true);
+  for (int mapped = 0; mapped < 2; mapped++) {
+    opt->setFileMapping(mapped == 1);
+    AnyOptionResult result;
+    REQUIRE(schema->processFile("test.options", result) == true);
+    REQUIRE_THAT(result.getValue(width), Equals("20"));
+    REQUIRE_THAT(result.getValue(height), Equals("30"));
+    REQUIRE_THAT(result.getValue(color), Equals("blue"));
+    REQUIRE(result.getFlag(verbose) == true);
+    REQUIRE_THAT(result.getValue(include), Equals("not a directive"));
+  }
+
+#if defined(__linux__)
+  // unchanged size and modification time, the split file is reused
+  struct stat st;
+  REQUIRE(stat("test.d/nested.options", &st) == 0);
+  {
+    ofstream nested("test.d/nested.options");
+    nested << "color : gray\nverbose\ninclude ../test.options\n";
+  }
+  struct timespec times[2] = {st.st_atim, st.st_mtim};
+  REQUIRE(utimensat(AT_FDCWD, "test.d/nested.options", times, 0) == 0);
+  AnyOptionResult cached;
+  REQUIRE(schema->processFile("test.options", cached) == true);
+  REQUIRE_THAT(cached.getValue(color), Equals("blue"));
+  AnyOption::clearIncludeCache();
+  AnyOptionResult cleared;
+  REQUIRE(schema->processFile("test.options", cleared) == true);
+  REQUIRE_THAT(cleared.getValue(color), Equals("gray"));
+#endif
+
+  {
+    ofstream nested("test.d/nested.options");
+    nested << "color : green\n";
+  }
+  AnyOptionResult changed;
+  REQUIRE(schema->processFile("test.options", changed) == true);
+  REQUIRE_THAT(changed.getValue(color), Equals("green"));
+
+  // includes in every part of a parallel parse
+  {
+    ofstream large("test.d/large.options");
+    for (int i = 0; i < 200000; i++)
+      large << "width : " << i << "\ninclude common.options\n";
+    large << "height : last\n";
+  }
+  opt->setFileThreads(4);
+  AnyOptionResult parallel;
+  REQUIRE(schema->processFile("test.d/large.options", parallel) == true);
+  REQUIRE_THAT(parallel.getValue(width), Equals("20"));
+  REQUIRE_THAT(parallel.getValue(height), Equals("last"));
+  REQUIRE_THAT(parallel.getValue(color), Equals("green"));
+
+  // a layer includes from its own directory and is in the cycle check
+  {
+    ofstream layer("test.d/layer.options");
+    layer << "height : layer\ninclude fragment.options\ninclude layer.options\n";
+    ofstream fragment("test.d/fragment.options");
+    fragment << "color : layered\n";
+  }
+  const char *files[] = {"test.options", "test.d/layer.options"};
+  opt->setFileMapping(false); /* read, not through parseSource() */
+  for (unsigned int threads = 0; threads < 2; threads++) {
+    opt->setFileThreads(threads);
+    AnyOptionResult layered;
+    REQUIRE(schema->processLayers(files, 2, 0, nullptr, layered) == true);
+    REQUIRE_THAT(layered.getValue(width), Equals("20"));
+    REQUIRE_THAT(layered.getValue(height), Equals("layer"));
+    REQUIRE_THAT(layered.getValue(color), Equals("layered"));
+    REQUIRE_THAT(layered.getValue(include), Equals("not a directive"));
+  }
+
+  delete opt;
+  remove("test.d/layer.options");
+  remove("test.d/fragment.options");
+  remove("test.d/large.options");
+  remove("test.d/nested.options");
+  remove("test.d/common.options");
+  remove("test.options");
+  rmdir("test.d");
+}
+#endif
+
+TEST_CASE("Test environment options") {
+
+  AnyOption *opt = new AnyOption();
+  AnyOptionSlot width = opt->setOption("max-width");
+  AnyOptionSlot verbose = opt->setFlag("verbose");
+  AnyOptionSlot quiet = opt->setFlag("quiet");
+  AnyOptionSlot home = opt->setEnvironmentOption("HOME");
+  AnyOptionSlot user = opt->setCommandOption("user");
+  AnyOptionSlot file = opt->setFileOption("file.only");
+  const AnyOption *schema = opt;
+
+  char *envp[] = {(char *)"APP_MAX_WIDTH=80", (char *)"APP_VERBOSE=yes",
+                  (char *)"APP_QUIET=maybe",  (char *)"HOME=/home/test",
+                  (char *)"APP_FILE_ONLY=1",  (char *)"LOGNAME=tester",
+                  (char *)"PATH=/bin",        (char *)"APP_HOME=/srv/app",
+                  nullptr};
+
+  AnyOptionResult unprefixed; /* only the environment options */
+  REQUIRE(schema->processEnvironment(envp, unprefixed) == true);
+  REQUIRE_THAT(unprefixed.getValue(home), Equals("/home/test"));
+  REQUIRE(unprefixed.getValue(width) == NULL);
+
+  opt->setEnvironmentPrefix("APP_");
+  AnyOptionSlot height = opt->setOption("height"); /* added after the prefix */
+  REQUIRE(opt->setEnvironmentName(user, "LOGNAME") == true);
+  REQUIRE(opt->setEnvironmentName(AnyOptionSlot(100), "NOTHING") == false);
+  for (int i = 0; i < 40; i++) { /* grow the table */
+    static char names[40][8];
+    snprintf(names[i], sizeof(names[i]), "n%d", i);
+    opt->setOption(names[i]);
+  }
+
+  AnyOptionResult result;
+  REQUIRE(schema->processEnvironment(envp, result) == true);
+  REQUIRE_THAT(result.getValue(width), Equals("80"));
+  REQUIRE(result.getFlag(verbose) == true);
+  REQUIRE(result.getFlag(quiet) == false);
+  REQUIRE_THAT(result.getValue(home), Equals("/srv/app")); /* prefixed now */
+  REQUIRE_THAT(result.getValue(user), Equals("tester"));
+  REQUIRE(result.getValue(file) == NULL);
+  REQUIRE(result.getValue(height) == NULL);
+  REQUIRE(result.getStats().lookups >= 5);
+
+  // the environment only reads, a false flag clears one
+  char *off[] = {(char *)"APP_VERBOSE=off", nullptr};
+  REQUIRE(schema->processEnvironment(off, result) == true);
+  REQUIRE(result.getFlag(verbose) == false);
+  char *unrelated[] = {(char *)"APP_WIDTH=1", (char *)"PATH=/bin", nullptr};
+  AnyOptionResult nothing;
+  REQUIRE(schema->processEnvironment(unrelated, nothing) == false);
+  REQUIRE(nothing.hasOptions() == false);
+
+  // HOME is not an option on the command line
+  int argc = 3;
+  char *argv[] = {(char *)"test", (char *)"--HOME", (char *)"/root"};
+  AnyOptionResult command;
+  schema->processCommandArgs(argc, argv, command);
+  REQUIRE(command.getValue(home) == NULL);
+
+#if !defined(_WIN32)
+  // between the files and the command line
+  {
+    ofstream options("test.options");
+    options << "max-width : 10\nheight : 20\n";
+  }
+  const char *files[] = {"test.options"};
+  char *args[] = {(char *)"test", (char *)"--height", (char *)"40"};
+  REQUIRE(setenv("APP_MAX_WIDTH", "30", 1) == 0);
+  REQUIRE(setenv("APP_HEIGHT", "30", 1) == 0);
+  AnyOptionResult layered;
+  REQUIRE(schema->processLayers(files, 1, 3, args, layered) == true);
+  REQUIRE_THAT(layered.getValue(width), Equals("30"));
+  REQUIRE_THAT(layered.getValue(height), Equals("40"));
+
+  REQUIRE(opt->processEnvironment() == true);
+  REQUIRE_THAT(opt->getValue("max-width"), Equals("30"));
+  unsetenv("APP_MAX_WIDTH");
+  unsetenv("APP_HEIGHT");
+  remove("test.options");
+#endif
+
+  delete opt;
+}
+
+TEST_CASE("Test response files") {
+
+  {
+    ofstream response("test.response");
+    response << "--width 80 'two words' \"say \\\"hi\\\"\"\n"
+                "  back\\ slash -v ''\n@test.nested\n";
+    ofstream nested("test.nested");
+    nested << "--height=20 nested\n";
+    ofstream self("test.self");
+    self << "x @test.self\n";
+    ofstream paths("test.paths");
+    for (int i = 0; i < 50000; i++)
+      paths << "/data/file" << i << ".txt\n";
+  }
+
+  AnyOption *opt = new AnyOption();
+  AnyOptionSlot width = opt->setOption("width");
+  AnyOptionSlot height = opt->setOption("height");
+  AnyOptionSlot verbose = opt->setFlag("verbose", 'v');
+  const AnyOption *schema = opt;
+
+  int argc = 4;
+  char *argv[] = {(char *)"test", (char *)"first", (char *)"@test.response",
+                  (char *)"@test.missing"};
+
+  AnyOptionResult literal; /* off by default */
+  schema->processCommandArgs(argc, argv, literal);
+  REQUIRE(literal.getArgc() == 3);
+  REQUIRE_THAT(literal.getArgv(1), Equals("@test.response"));
+
+  opt->setResponseFiles(true);
+  for (int borrow = 0; borrow < 2; borrow++) {
+    opt->setArgvBorrowing(borrow == 1);
+    AnyOptionResult result;
+    schema->processCommandArgs(argc, argv, result);
+    REQUIRE_THAT(result.getValue(width), Equals("80"));
+    REQUIRE_THAT(result.getValue(height), Equals("20"));
+    REQUIRE(result.getFlag(verbose) == true);
+    REQUIRE(result.getArgc() == 7);
+    REQUIRE_THAT(result.getArgv(0), Equals("first"));
+    REQUIRE_THAT(result.getArgv(1), Equals("two words"));
+    REQUIRE_THAT(result.getArgv(2), Equals("say \"hi\""));
+    REQUIRE_THAT(result.getArgv(3), Equals("back slash"));
+    REQUIRE_THAT(result.getArgv(4), Equals(""));
+    REQUIRE_THAT(result.getArgv(5), Equals("nested"));
+    REQUIRE_THAT(result.getArgv(6), Equals("@test.missing"));
+    REQUIRE(result.getArgv(7) == NULL);
+  }
+
+  // a directory stays a plain argument
+  char *directory[] = {(char *)"test", (char *)"@.", (char *)"last"};
+  AnyOptionResult listed;
+  schema->processCommandArgs(3, directory, listed);
+  REQUIRE(listed.getArgc() == 2);
+  REQUIRE_THAT(listed.getArgv(0), Equals("@."));
+  REQUIRE_THAT(listed.getArgv(1), Equals("last"));
+
+  // an option value can come from the file
+  char *split[] = {(char *)"test", (char *)"--width", (char *)"@test.nested"};
+  AnyOptionResult value;
+  schema->processCommandArgs(3, split, value);
+  REQUIRE_THAT(value.getValue(width), Equals("--height=20"));
+  REQUIRE(value.getArgc() == 1);
+
+  // a cycle stops at the nesting limit
+  char *cycle[] = {(char *)"test", (char *)"@test.self"};
+  AnyOptionResult cycled;
+  schema->processCommandArgs(2, cycle, cycled);
+  REQUIRE(cycled.getArgc() == RESPONSE_FILE_DEPTH + 1);
+  REQUIRE_THAT(cycled.getArgv(RESPONSE_FILE_DEPTH), Equals("@test.self"));
+
+  // beyond ARG_MAX, and the argument limit still holds
+  char *many[] = {(char *)"test", (char *)"@test.paths"};
+  AnyOptionResult paths;
+  schema->processCommandArgs(2, many, paths);
+  REQUIRE(paths.getArgc() == 50000);
+  REQUIRE_THAT(paths.getArgv(49999), Equals("/data/file49999.txt"));
+  AnyOptionResult limited;
+  schema->processCommandArgs(2, many, 10, limited);
+  REQUIRE(limited.getArgc() == 10);
+
+  opt->processCommandArgs(argc, argv);
+  REQUIRE_THAT(opt->getValue("width"), Equals("80"));
+  REQUIRE(opt->getArgc() == 7);
+
+  delete opt;
+  remove("test.response");
+  remove("test.nested");
+  remove("test.self");
+  remove("test.paths");
+}
+
+TEST_CASE("Test abbreviated options and completion") {
+
+  AnyOption *opt = new AnyOption();
+  AnyOptionSlot verbose = opt->setFlag("verbose");
+  AnyOptionSlot version = opt->setCommandFlag("version");
+  AnyOptionSlot width = opt->setOption("width");
+  AnyOptionSlot col = opt->setOption("col");
+  AnyOptionSlot color = opt->setOption("color");
+  AnyOptionSlot height = opt->setFileOption("height");
+  const AnyOption *schema = opt;
+
+  int argc = 3;
+  char *argv[] = {(char *)"test", (char *)"--verb", (char *)"--colo=red"};
+  AnyOptionResult exact; /* off by default */
+  schema->processCommandArgs(argc, argv, exact);
+  REQUIRE(exact.getFlag(verbose) == false);
+  REQUIRE(exact.getValue(color) == NULL);
+
+  opt->setAbbreviations(true);
+  AnyOptionSlot depth = opt->setOption("depth"); /* added after */
+  char *abbreviated[] = {(char *)"test", (char *)"--verb",  (char *)"--colo=red",
+                         (char *)"--col", (char *)"blue",   (char *)"--wid",
+                         (char *)"80",    (char *)"--ver",  (char *)"--hei",
+                         (char *)"5",     (char *)"--dep",  (char *)"3"};
+  AnyOptionResult result;
+  schema->processCommandArgs(12, abbreviated, result);
+  REQUIRE(result.getFlag(verbose) == true);
+  REQUIRE_THAT(result.getValue(color), Equals("red"));
+  REQUIRE_THAT(result.getValue(col), Equals("blue")); /* the full name wins */
+  REQUIRE_THAT(result.getValue(width), Equals("80"));
+  REQUIRE(result.getFlag(version) == false); /* ambiguous */
+  REQUIRE(result.getValue(height) == NULL);  /* not a command option */
+  REQUIRE_THAT(result.getValue(depth), Equals("3"));
+  REQUIRE(result.getArgc() == 1);
+  REQUIRE_THAT(result.getArgv(0), Equals("5"));
+
+  ostringstream some;
+  REQUIRE(schema->complete("--ve", some) == 2);
+  REQUIRE_THAT(some.str(), Equals("--verbose\n--version\n"));
+  ostringstream all;
+  REQUIRE(schema->complete("-", all) == 6);
+  REQUIRE_THAT(all.str(), Equals("--col\n--color\n--depth\n--verbose\n"
+                                 "--version\n--width\n"));
+  ostringstream none;
+  REQUIRE(schema->complete("--x", none) == 0);
+  REQUIRE(none.str().empty());
+
+  // many options, the trie grows
+  vector<string> names;
+  for (int i = 0; i < 800; i++)
+    names.push_back("option-" + to_string(i));
+  for (const string &name : names)
+    opt->setOption(name.c_str());
+  ostringstream grown;
+  REQUIRE(schema->complete("--option-79", grown) == 11);
+  char *many[] = {(char *)"test", (char *)"--option-799", (char *)"last",
+                  (char *)"--optio", (char *)"ambiguous"};
+  AnyOptionResult last;
+  schema->processCommandArgs(5, many, last);
+  REQUIRE_THAT(last.getValue("option-799"), Equals("last"));
+  REQUIRE(last.getArgc() == 1);
+  REQUIRE_THAT(last.getArgv(0), Equals("ambiguous"));
+
+  // parsing into a result only records the request
+  opt->setCompletionOption("complete");
+  char *typing[] = {(char *)"test", (char *)"--width", (char *)"7",
+                    (char *)"--complete", (char *)"--he", (char *)"--color",
+                    (char *)"red"};
+  AnyOptionResult asked;
+  schema->processCommandArgs(7, typing, asked);
+  REQUIRE_THAT(asked.getCompletion(), Equals("--he"));
+  REQUIRE_THAT(asked.getValue("width"), Equals("7"));
+  REQUIRE(asked.getValue("color") == nullptr);
+  schema->processCommandArgs(3, typing, asked);
+  REQUIRE(asked.getCompletion() == nullptr);
+
+#if !defined(_WIN32)
+  // the shell asks and the classic versions answer and exit
+  for (int layered = 0; layered < 2; layered++) {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    cout.flush(); /* nothing buffered for the child to repeat */
+    pid_t child = fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+      dup2(fds[1], 1);
+      char *ask[] = {(char *)"test", (char *)"--complete", (char *)"--wi",
+                     (char *)"--never-parsed"};
+      const char *files[] = {"test.missing.options"};
+      if (layered == 1) {
+        opt->useCommandArgs(4, ask);
+        opt->processLayers(files, 1);
+      } else {
+        opt->processCommandArgs(4, ask);
+      }
+      _exit(1);
+    }
+    close(fds[1]);
+    string answer;
+    char buffer[256];
+    ssize_t got;
+    while ((got = read(fds[0], buffer, sizeof(buffer))) > 0)
+      answer.append(buffer, got);
+    close(fds[0]);
+    int status = 0;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+    REQUIRE_THAT(answer, Equals("--width\n"));
+  }
+#endif
+
+  // the trie moves with the rest of the storage
+  CountingPool pool = {map<void *, size_t>(), 0, true};
+  AnyOptionAllocator allocator = {poolAllocate, poolDeallocate, &pool};
+  REQUIRE(opt->setAllocator(allocator) == true);
+  ostringstream moved;
+  REQUIRE(schema->complete("--option-79", moved) == 11);
+  REQUIRE_THAT(moved.str(), Equals(grown.str()));
+
+  delete opt;
+  REQUIRE(pool.blocks.empty());
+  REQUIRE(pool.sizes_matched);
+}
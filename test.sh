@@ -10,11 +10,14 @@ cppcheck --error-exitcode=1 --enable=warning,performance,information,style *.cpp
 wget -q https://github.com/catchorg/Catch2/releases/download/v2.2.3/catch.hpp
 g++ -g -o0 -coverage -std=c++11 -Wall -Wextra -Werror test.cpp anyoption.cpp -o test
 valgrind --error-exitcode=1 --leak-check=full --show-leak-kinds=all ./test
+g++ -g -fsanitize=thread -std=c++11 -Wall -Wextra -Werror -pthread test.cpp anyoption.cpp -o test_tsan
+./test_tsan
 lcov --directory . --capture --output-file coverage.info
 lcov --remove coverage.info 'catch.hpp' '/usr/*' --output-file coverage.info
 lcov --list coverage.info
 # clean
 rm test
+rm test_tsan
 rm test.options
 rm catch.hpp
 rm coverage.info